@@ -14,6 +14,7 @@
 #endif
 
 #include "printer.h"
+#include "spool.h"
 
 // Global variables - shared with printer.h
 int draw_tractor_edges = 0;
@@ -30,24 +31,32 @@ int wrap_enabled = 0;
 int guide_single_line = 0;
 int guide_music_style = 0;
 int green_blue = 0;
+int dot_style = DOT_STYLE_STROKE;
+int pdf_compress_level = -1;
+int pdf_units = 0;
+int pdf_object_streams = 0;
+int pdf_linearize = 0;
+int raster_format = RASTER_NONE;
+int raster_dpi = 200;
+int svg_output = 0;
+float dot_overprint_tolerance = 0.0f;
 float page_width = PAGE_WIDTH;
 float page_height = PAGE_HEIGHT;
 int page_cpi = PAGE_CPI;
 int page_lpi = PAGE_LPI;
-float page_xmargin = PAGE_XMARGIN;
-float page_ymargin = PAGE_YMARGIN;
+int page_xmargin = (int)(PAGE_XMARGIN * DEVICE_DPI);
+int page_ymargin = (int)(PAGE_YMARGIN * DEVICE_DPI);
 int line_count = 0;
-float xpos = PAGE_XMARGIN;
-float ypos = PAGE_YMARGIN;
-float xstep = 0.5;
-float ystep = 1.0;
-float step60 = 1.0 / 52.9;
-float step72 = 1.0 / 72.0;
-float lstep = 1.0 / 6.0;
-float yoffset = 0.0;
+int xpos = (int)(PAGE_XMARGIN * DEVICE_DPI);
+int ypos = (int)(PAGE_YMARGIN * DEVICE_DPI);
+int xstep = DEVICE_DPI / 120;
+int ystep = DEVICE_DPI / 72;
+int lstep = DEVICE_DPI / 6;
+int yoffset = 0;
 int epson_initialized = 0;
 int charset[256*9] = {0};
 float vintage_dot_misalignment[9] = {0};
+int type3_text = 0;
 int mode_bold = 0;
 int mode_italic = 0;
 int mode_doublestrike = 0;
@@ -61,14 +70,14 @@ int mode_compressed = 0;
 int auto_cr = 0;
 FILE *fi;
 FILE *fo;
-char **pdf_contents = NULL;
-size_t *pdf_lens = NULL;
-size_t *pdf_caps = NULL;
 int pdf_pages = 0;
 
 static void print_usage(const char *prog)
 {
     fprintf(stderr, "Usage: %s [options] <inputfile>\n", prog);
+    fprintf(stderr, "       %s [options] -B <inputfile>...\n", prog);
+    fprintf(stderr, "       %s [options] -M <manifest>\n", prog);
+    fprintf(stderr, "       %s [options] -W <spooldir> -o <outdir>\n", prog);
     fprintf(stderr, "Options:\n");
     fprintf(stderr, "  -a, --autocr     Automatically carriage return after line feed\n");
     fprintf(stderr, "  -e, --edge       Add perforated tractor edges (0.5in each side)\n");
@@ -81,6 +90,19 @@ static void print_usage(const char *prog)
     fprintf(stderr, "  -s, --stdin      Read input from standard input (takes precedence)\n");
     fprintf(stderr, "  -r, --wrap       Wrap long lines to next line instead of discarding\n");
     fprintf(stderr, "  -f, --font F     Specify font to use (default: printer.ttf)\n");
+    fprintf(stderr, "  -z, --compress L Flate-compress streams: 0-9, store, fast, default or best\n");
+    fprintf(stderr, "  -5, --pdf15      Write PDF 1.5 with object streams and an xref stream\n");
+    fprintf(stderr, "  -L, --linearize  Write a linearized PDF (fast web view, first page first)\n");
+    fprintf(stderr, "  -A, --append     Add to the -o file written by an earlier -A run (state in <file>.state)\n");
+    fprintf(stderr, "  -R, --raster F   Write page images instead of a PDF: 'png', 'pgm' or 'tiff' (G4)\n");
+    fprintf(stderr, "  -p, --dpi N      Resolution of page images (default 200)\n");
+    fprintf(stderr, "  -S, --svg        Write SVG pages instead of a PDF\n");
+    fprintf(stderr, "  -D, --dots M     Dot encoding: 'stroke' (default), 'path' or 'xobject'\n");
+    fprintf(stderr, "  -u, --units N    Write coordinates as integers in 1/N inch (e.g. 2160)\n");
+    fprintf(stderr, "  -B, --batch      Convert every input file named, each to <input>.pdf (in the -o directory)\n");
+    fprintf(stderr, "  -M, --manifest F Convert the jobs listed in F, one 'input output [options]' per line\n");
+    fprintf(stderr, "  -W, --spool D    Stay resident converting each file that lands in D to the -o directory\n");
+    fprintf(stderr, "  -j, --jobs N     Conversions run at once in spool mode (default 1)\n");
     fprintf(stderr, "  -d, --debug      Enable debug messages\n");
     fprintf(stderr, "  -v, --vintage    Emulate worn ribbon + misalignment\n");
     fprintf(stderr, "  -h, --help       Show this help\n");
@@ -133,7 +155,7 @@ void vintage_init(unsigned int seed) {
     // determine number of character columns based on printable width and CPI
     vintage_cols = (int)(page_width * page_cpi + 0.5f);
     if (vintage_cols < 1) vintage_cols = 1;
-    vintage_col_intensity = (float*)malloc(sizeof(float) * vintage_cols);
+    vintage_col_intensity = (float*)realloc(vintage_col_intensity, sizeof(float) * vintage_cols);
     // Seed RNG for repeatability
     srand(seed);
     // Fill per-column intensity: base around 0.7..1.0 with small variation
@@ -161,22 +183,52 @@ void vintage_init(unsigned int seed) {
     print_stderr("Vintage: initialized %d cols\n", vintage_cols);
 }
 
-// Main program
-int main(int argc, char *argv[])
+// Options of the conversion being set up (the others are globals above)
+static char *outname = NULL;
+static int opt_edge = 0;
+static int opt_guides = 0;
+static int opt_single = 0;
+static int opt_blue = 0;
+static int opt_music = 0;
+static int opt_wide = 0;
+static int opt_stdin = 0;
+static int opt_autocr = 0;
+static int opt_append = 0;
+static char *opt_font = "Printer.ttf";
+static int opt_batch = 0;
+static char *opt_manifest = NULL;
+static char *opt_spool = NULL;
+static int opt_jobs = 1;
+
+// Return the options of a conversion to their defaults
+static void reset_options(void)
+{
+    free(outname);
+    outname = NULL;
+    opt_edge = opt_guides = opt_single = opt_blue = opt_music = 0;
+    opt_wide = opt_stdin = opt_autocr = opt_append = 0;
+    opt_font = "Printer.ttf";
+    auto_cr = 0;
+    draw_tractor_edges = draw_guide_strips = guide_single_line = green_blue = guide_music_style = 0;
+    wide_carriage = 0;
+    page_width = PAGE_WIDTH;
+    wrap_enabled = 0;
+    pdf_compress_level = -1;
+    pdf_object_streams = 0;
+    pdf_linearize = 0;
+    raster_format = RASTER_NONE;
+    raster_dpi = 200;
+    svg_output = 0;
+    dot_style = DOT_STYLE_STROKE;
+    pdf_units = 0;
+    debug_enabled = 0;
+    vintage_enabled = 0;
+}
+
+// Parse the options in argv. Returns 0 if they are valid, 2 after printing
+// the help, 1 on error.
+static int parse_options(int argc, char *argv[])
 {
-    char *filename;
-    char *outname = NULL;
-    int opt_edge = 0;
-    int opt_guides = 0;
-    int opt_single = 0;
-    int opt_blue = 0;
-    int opt_music = 0;
-    int opt_wide = 0;
-    int opt_stdin = 0;
-    int opt_autocr = 0;
-    char *opt_font = "Printer.ttf";
-
-    // Parse command line options
     static struct option long_options[] = {
         {"autocr", no_argument, 0, 'a'},
         {"edge", no_argument, 0, 'e'},
@@ -189,6 +241,19 @@ int main(int argc, char *argv[])
         {"stdin", no_argument, 0, 's'},
         {"wrap", no_argument, 0, 'r'},
         {"font", required_argument, 0, 'f'},
+        {"compress", required_argument, 0, 'z'},
+        {"pdf15", no_argument, 0, '5'},
+        {"linearize", no_argument, 0, 'L'},
+        {"append", no_argument, 0, 'A'},
+        {"raster", required_argument, 0, 'R'},
+        {"dpi", required_argument, 0, 'p'},
+        {"svg", no_argument, 0, 'S'},
+        {"dots", required_argument, 0, 'D'},
+        {"units", required_argument, 0, 'u'},
+        {"batch", no_argument, 0, 'B'},
+        {"manifest", required_argument, 0, 'M'},
+        {"spool", required_argument, 0, 'W'},
+        {"jobs", required_argument, 0, 'j'},
         {"debug", no_argument, 0, 'd'},
         {"vintage", no_argument, 0, 'v'},
         {"help", no_argument, 0, 'h'},
@@ -196,7 +261,8 @@ int main(int argc, char *argv[])
     int opt;
     int opt_index = 0;
     // getopt loop: options come before the input filename
-    while ((opt = getopt_long(argc, argv, "aeg1bmo:wsrf:dvh", long_options, &opt_index)) != -1)
+    optind = 0;
+    while ((opt = getopt_long(argc, argv, "aeg1bmo:wsrf:z:5LAR:p:SD:u:BM:W:j:dvh", long_options, &opt_index)) != -1)
     {
         switch (opt)
         {
@@ -219,6 +285,7 @@ int main(int argc, char *argv[])
             opt_music = 1;
             break;
         case 'o':
+            free(outname);
             outname = strdup(optarg);
             break;
         case 'w':
@@ -231,7 +298,95 @@ int main(int argc, char *argv[])
             wrap_enabled = 1;
             break;
         case 'f':
-            opt_font = strdup(optarg);
+            opt_font = optarg;
+            break;
+        case 'z':
+            if (strcmp(optarg, "store") == 0) {
+                pdf_compress_level = 0;
+            } else if (strcmp(optarg, "fast") == 0) {
+                pdf_compress_level = 1;
+            } else if (strcmp(optarg, "default") == 0) {
+                pdf_compress_level = 6;
+            } else if (strcmp(optarg, "best") == 0) {
+                pdf_compress_level = 9;
+            } else if (optarg[0] >= '0' && optarg[0] <= '9' && optarg[1] == '\0') {
+                pdf_compress_level = optarg[0] - '0';
+            } else {
+                fprintf(stderr, "Unknown compression level '%s'\n", optarg);
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case '5':
+            pdf_object_streams = 1;
+            break;
+        case 'L':
+            pdf_linearize = 1;
+            break;
+        case 'A':
+            opt_append = 1;
+            break;
+        case 'R':
+            if (strcmp(optarg, "png") == 0) {
+                raster_format = RASTER_PNG;
+            } else if (strcmp(optarg, "pgm") == 0) {
+                raster_format = RASTER_PGM;
+            } else if (strcmp(optarg, "tiff") == 0) {
+                raster_format = RASTER_TIFF;
+            } else {
+                fprintf(stderr, "Unknown raster format '%s'\n", optarg);
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'p':
+            raster_dpi = atoi(optarg);
+            if (raster_dpi < 10 || raster_dpi > 2400) {
+                fprintf(stderr, "Invalid resolution '%s' (10-2400 dpi)\n", optarg);
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'S':
+            svg_output = 1;
+            break;
+        case 'D':
+            if (strcmp(optarg, "path") == 0) {
+                dot_style = DOT_STYLE_PATH;
+            } else if (strcmp(optarg, "stroke") == 0) {
+                dot_style = DOT_STYLE_STROKE;
+            } else if (strcmp(optarg, "xobject") == 0) {
+                dot_style = DOT_STYLE_XOBJECT;
+            } else {
+                fprintf(stderr, "Unknown dot encoding '%s'\n", optarg);
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'u':
+            pdf_units = atoi(optarg);
+            if (pdf_units < 72 || pdf_units > 100000) {
+                fprintf(stderr, "Invalid unit count '%s' (72-100000 units per inch)\n", optarg);
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'B':
+            opt_batch = 1;
+            break;
+        case 'M':
+            opt_manifest = optarg;
+            break;
+        case 'W':
+            opt_spool = optarg;
+            break;
+        case 'j':
+            opt_jobs = atoi(optarg);
+            if (opt_jobs < 1 || opt_jobs > SPOOL_MAX_WORKERS) {
+                fprintf(stderr, "Invalid number of jobs '%s' (1-%d)\n", optarg, SPOOL_MAX_WORKERS);
+                print_usage(argv[0]);
+                return 1;
+            }
             break;
         case 'd':
             debug_enabled = 1;
@@ -243,32 +398,63 @@ int main(int argc, char *argv[])
             break;
         case 'h':
             print_usage(argv[0]);
-            return 0;
+            return 2;
         default:
             print_usage(argv[0]);
             return 1;
         }
     }
 
-    // Decide input source: stdin (-s) takes precedence over any filename supplied
-    if (opt_stdin)
+    // Object streams cannot be kept when the document is reordered
+    if (pdf_object_streams && pdf_linearize)
+    {
+        fprintf(stderr, "Choose either PDF 1.5 object streams (-5) or a linearized PDF (-L)\n");
+        return 1;
+    }
+    return 0;
+}
+
+// Options of one conversion of a batch: those of the command line, then
+// the job's own
+static int job_options(int argc, char *argv[], int job_argc, char *job_argv[])
+{
+    reset_options();
+    if (parse_options(argc, argv))
+        return 1;
+    if (job_argc > 1 && parse_options(job_argc, job_argv))
+        return 1;
+    return 0;
+}
+
+// Convert filename (standard input if NULL) to output (standard output if
+// NULL) with the options set up. Returns nonzero on error.
+static int convert(const char *filename, const char *output)
+{
+    if (raster_format && svg_output)
+    {
+        fprintf(stderr, "Choose either page images (-R) or SVG (-S)\n");
+        return 1;
+    }
+    // Append mode updates a named file in place
+    if (opt_append && (output == NULL || pdf_linearize || raster_format || svg_output))
+    {
+        fprintf(stderr, "Append mode needs an output file (-o) and cannot be linearized, rasterized or SVG\n");
+        return 1;
+    }
+
+    if (filename != NULL && output != NULL && output_is_input(filename, output))
+    {
+        fprintf(stderr, "Output file %s is the input file\n", output);
+        return 1;
+    }
+
+    // Open input file
+    if (filename == NULL)
     {
         fi = stdin;
     }
     else
     {
-        // Check if there is a filename after the options
-        if (optind < argc)
-        {
-            filename = argv[optind];
-        }
-        else
-        {
-            print_usage(argv[0]);
-            return 1;
-        }
-
-        // Open input file
         fi = fopen(filename, "rb");
         if (fi == NULL)
         {
@@ -278,12 +464,22 @@ int main(int argc, char *argv[])
     }
 
     // Open output file or stdout
-    if (outname != NULL)
+    if (opt_append)
+    {
+        fo = append_open(output);
+        if (fo == NULL)
+        {
+            fclose(fi);
+            return 1;
+        }
+    }
+    else if (output != NULL)
     {
-        fo = fopen(outname, "wb");
+        fo = fopen(output, "wb");
         if (fo == NULL)
         {
-            fprintf(stderr, "Error opening file %s\n", outname);
+            fprintf(stderr, "Error opening file %s\n", output);
+            fclose(fi);
             return 1;
         }
     }
@@ -346,15 +542,26 @@ int main(int argc, char *argv[])
         print_stderr("Wide carriage enabled (printable %.3fin).\n", page_width);
     }
 
-    // Initialize the PDF buffer and the printer
-    pdf_init();
+    // Page images are written by the raster backend
+    if (raster_format)
+        raster_init(fo, fo == stdout ? NULL : (output ? output : "out.pdf"));
+    if (svg_output)
+        svg_init(fo, fo == stdout ? NULL : (output ? output : "out.pdf"));
+
+    // Start the PDF document (the header is written immediately); in append
+    // mode once the printer is initialized
+    if (!opt_append)
+        pdf_init(fo);
     
     // Resolve font path relative to executable directory and load the font
     char *font_path = resolve_font_path(opt_font);
     print_stderr("Font path resolved to: %s\n", font_path);
-    pdf_load_font(font_path);
+    if (!pdf_load_font(font_path) && (raster_format || svg_output))
+        print_stderr("Warning: page images and SVG need the font file; characters are not drawn\n");
     
-    printer_reset();
+    printer_power_on();
+    if (opt_append)
+        append_begin(fo);
 
     // Initialize vintage emulation if requested
     if (vintage_enabled) {
@@ -366,41 +573,27 @@ int main(int argc, char *argv[])
     int c;
     while (1)
     {
+        append_mark();
         c = file_get_char(fi);
         if (c == EOF)
             break;
         if (hammer_process_char(c))
             break;
+        append_check();
     }
     print_stderr("\nEnd of file.\n");
 
-    // Write the generated PDF to the requested output
-    if (fo == stdout)
+    // Write the last page and the document trailer
+    int result = 0;
+    if (pdf_finish())
     {
-        FILE *tmp = tmpfile();
-        if (tmp == NULL)
-        {
-            fprintf(stderr, "Error: cannot create temporary file for PDF output\n");
-            fclose(fi);
-            return 1;
-        }
-        pdf_write(tmp);
-        rewind(tmp);
-        char buf[8192];
-        size_t n;
-        while ((n = fread(buf, 1, sizeof(buf), tmp)) > 0)
-        {
-            if (fwrite(buf, 1, n, stdout) != n)
-            {
-                fprintf(stderr, "Error writing PDF to stdout\n");
-                break;
-            }
-        }
-        fclose(tmp);
+        fprintf(stderr, "Error writing PDF output\n");
+        result = 1;
     }
-    else
+    else if (opt_append && append_save())
     {
-        pdf_write(fo);
+        fprintf(stderr, "Error writing state file %s\n", append_path);
+        result = 1;
     }
 
     // Close files
@@ -410,5 +603,55 @@ int main(int argc, char *argv[])
         fclose(fo);
     }
 
-    return 0;
+    return result;
+}
+
+// What every spooled conversion shares: the font
+static void preload(void)
+{
+    pdf_load_font(resolve_font_path(opt_font));
+}
+
+// Main program
+int main(int argc, char *argv[])
+{
+    int result = parse_options(argc, argv);
+    if (result)
+        return result == 2 ? 0 : 1;
+
+    // Spool mode: a resident daemon converting the files put in a directory
+    if (opt_spool)
+    {
+        if (opt_batch || opt_manifest || opt_append || opt_stdin || outname == NULL || optind < argc)
+        {
+            fprintf(stderr, "Spool mode takes a spool directory (-W) and an output directory (-o), and no input files, -B, -M, -A or -s\n");
+            return 1;
+        }
+        char *dir = strdup(outname);
+        result = spool_run(argc, argv, opt_spool, dir, opt_jobs, preload, job_options, convert);
+        free(dir);
+        return result;
+    }
+
+    // Batch mode: many conversions in this process
+    if (opt_batch || opt_manifest)
+    {
+        if (opt_append || opt_stdin || (opt_batch && opt_manifest) || (opt_batch && optind >= argc))
+        {
+            fprintf(stderr, "Batch mode takes input files (-B) or a manifest (-M), and no -A or -s\n");
+            return 1;
+        }
+        char *dir = outname ? strdup(outname) : NULL;
+        result = batch_run(argc, argv, optind, opt_manifest, dir, job_options, convert);
+        free(dir);
+        return result;
+    }
+
+    // Decide input source: stdin (-s) takes precedence over any filename supplied
+    if (!opt_stdin && optind >= argc)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+    return convert(opt_stdin ? NULL : argv[optind], outname);
 }
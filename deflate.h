@@ -0,0 +1,451 @@
+#ifndef DEFLATE_H
+#define DEFLATE_H
+
+#include <stdlib.h>
+#include <string.h>
+
+// --- Self-contained zlib (RFC 1950) / deflate (RFC 1951) encoder ---
+// Used for /FlateDecode streams. Level 0 writes stored blocks; levels 1-9
+// run LZ77 over a 32K window with hash chains (longer chains and lazy
+// matching at higher levels) and code each block with whichever of the
+// dynamic Huffman, fixed Huffman or stored encodings is smallest.
+
+#define DEFLATE_WINDOW 32768
+#define DEFLATE_HASH_BITS 15
+#define DEFLATE_MIN_MATCH 3
+#define DEFLATE_MAX_MATCH 258
+#define DEFLATE_BLOCK_SYMS 32768              // LZ77 symbols collected per block
+
+typedef struct {
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+    unsigned long bits;                       // pending bits (LSB first)
+    int nbits;
+} deflate_out;
+
+static const unsigned short deflate_len_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const unsigned char deflate_len_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const unsigned short deflate_dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const unsigned char deflate_dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+// Order in which code length code lengths are sent
+static const unsigned char deflate_cl_order[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+static void deflate_put_byte(deflate_out *o, unsigned char b) {
+    if (o->len + 1 > o->cap) {
+        o->cap = o->cap ? o->cap * 2 : 4096;
+        o->data = (unsigned char*)realloc(o->data, o->cap);
+    }
+    o->data[o->len++] = b;
+}
+
+static void deflate_put_bits(deflate_out *o, unsigned long value, int n) {
+    o->bits |= value << o->nbits;
+    o->nbits += n;
+    while (o->nbits >= 8) {
+        deflate_put_byte(o, (unsigned char)(o->bits & 0xFF));
+        o->bits >>= 8;
+        o->nbits -= 8;
+    }
+}
+
+static void deflate_align(deflate_out *o) {
+    if (o->nbits > 0) deflate_put_bits(o, 0, 8 - o->nbits);
+}
+
+// Huffman codes are sent most significant bit first
+static unsigned deflate_reverse(unsigned code, int len) {
+    unsigned r = 0;
+    for (int i = 0; i < len; i++) {
+        r = (r << 1) | (code & 1);
+        code >>= 1;
+    }
+    return r;
+}
+
+// Build code lengths (at most maxbits) for n symbols from their frequencies.
+// Frequencies are flattened and the tree rebuilt until it fits.
+static void deflate_build_lengths(const unsigned *freq, int n, int maxbits, unsigned char *len) {
+    unsigned f[288];
+    int sym[288];
+    int parent[2 * 288];
+    unsigned weight[2 * 288];
+    for (int i = 0; i < n; i++) f[i] = freq[i];
+    for (;;) {
+        memset(len, 0, (size_t)n);
+        int count = 0;
+        for (int i = 0; i < n; i++) {
+            if (f[i]) sym[count++] = i;
+        }
+        if (count == 0) return;
+        if (count == 1) {
+            len[sym[0]] = 1;
+            return;
+        }
+        // sort leaves by weight (insertion sort, n <= 288)
+        for (int i = 1; i < count; i++) {
+            int s = sym[i];
+            int j = i - 1;
+            while (j >= 0 && f[sym[j]] > f[s]) {
+                sym[j + 1] = sym[j];
+                j--;
+            }
+            sym[j + 1] = s;
+        }
+        // two-queue Huffman construction: leaves 0..count-1, internal nodes count..
+        for (int i = 0; i < count; i++) weight[i] = f[sym[i]];
+        int leaf = 0, node = count, next = count;
+        while (next < 2 * count - 1) {
+            int pick[2];
+            for (int k = 0; k < 2; k++) {
+                if (leaf < count && (node >= next || weight[leaf] <= weight[node])) {
+                    pick[k] = leaf++;
+                } else {
+                    pick[k] = node++;
+                }
+            }
+            weight[next] = weight[pick[0]] + weight[pick[1]];
+            parent[pick[0]] = next;
+            parent[pick[1]] = next;
+            next++;
+        }
+        // depth of each node, computed from the root downwards
+        int depth[2 * 288];
+        int root = 2 * count - 2;
+        depth[root] = 0;
+        int too_long = 0;
+        for (int i = root - 1; i >= 0; i--) {
+            depth[i] = depth[parent[i]] + 1;
+        }
+        for (int i = 0; i < count; i++) {
+            if (depth[i] > maxbits) too_long = 1;
+            len[sym[i]] = (unsigned char)depth[i];
+        }
+        if (!too_long) return;
+        for (int i = 0; i < n; i++) {
+            if (f[i]) f[i] = (f[i] >> 1) | 1;
+        }
+    }
+}
+
+// Canonical codes (already bit-reversed for output) from code lengths
+static void deflate_build_codes(const unsigned char *len, int n, unsigned *code) {
+    unsigned bl_count[16] = {0};
+    unsigned next_code[16];
+    for (int i = 0; i < n; i++) bl_count[len[i]]++;
+    bl_count[0] = 0;
+    unsigned c = 0;
+    for (int bits = 1; bits < 16; bits++) {
+        c = (c + bl_count[bits - 1]) << 1;
+        next_code[bits] = c;
+    }
+    for (int i = 0; i < n; i++) {
+        code[i] = len[i] ? deflate_reverse(next_code[len[i]]++, len[i]) : 0;
+    }
+}
+
+static int deflate_len_code(int length) {
+    int i = 28;
+    while (deflate_len_base[i] > length) i--;
+    return i;
+}
+
+static int deflate_dist_code(int dist) {
+    int i = 29;
+    while (deflate_dist_base[i] > dist) i--;
+    return i;
+}
+
+// LZ77 symbols of one block: literal (dist == 0) or length/distance pair
+typedef struct {
+    unsigned short lit_or_len;
+    unsigned short dist;
+} deflate_sym;
+
+static void deflate_write_symbols(deflate_out *o, const deflate_sym *syms, int nsyms,
+                                  const unsigned *lcode, const unsigned char *llen,
+                                  const unsigned *dcode, const unsigned char *dlen) {
+    for (int i = 0; i < nsyms; i++) {
+        if (syms[i].dist == 0) {
+            int s = syms[i].lit_or_len;
+            deflate_put_bits(o, lcode[s], llen[s]);
+        } else {
+            int l = syms[i].lit_or_len;
+            int lc = deflate_len_code(l);
+            deflate_put_bits(o, lcode[257 + lc], llen[257 + lc]);
+            if (deflate_len_extra[lc]) deflate_put_bits(o, (unsigned long)(l - deflate_len_base[lc]), deflate_len_extra[lc]);
+            int d = syms[i].dist;
+            int dc = deflate_dist_code(d);
+            deflate_put_bits(o, dcode[dc], dlen[dc]);
+            if (deflate_dist_extra[dc]) deflate_put_bits(o, (unsigned long)(d - deflate_dist_base[dc]), deflate_dist_extra[dc]);
+        }
+    }
+    deflate_put_bits(o, lcode[256], llen[256]);
+}
+
+static void deflate_write_stored(deflate_out *o, const unsigned char *src, size_t len, int final) {
+    size_t pos = 0;
+    do {
+        size_t n = len - pos;
+        if (n > 65535) n = 65535;
+        int last = final && (pos + n == len);
+        deflate_put_bits(o, (unsigned long)last, 1);
+        deflate_put_bits(o, 0, 2);
+        deflate_align(o);
+        deflate_put_byte(o, (unsigned char)(n & 0xFF));
+        deflate_put_byte(o, (unsigned char)(n >> 8));
+        deflate_put_byte(o, (unsigned char)(~n & 0xFF));
+        deflate_put_byte(o, (unsigned char)((~n >> 8) & 0xFF));
+        for (size_t i = 0; i < n; i++) deflate_put_byte(o, src[pos + i]);
+        pos += n;
+    } while (pos < len);
+}
+
+// Code one block of symbols covering src[0..len) with the cheapest encoding
+static void deflate_write_block(deflate_out *o, const deflate_sym *syms, int nsyms,
+                                const unsigned char *src, size_t len, int final) {
+    unsigned lfreq[286] = {0};
+    unsigned dfreq[30] = {0};
+    for (int i = 0; i < nsyms; i++) {
+        if (syms[i].dist == 0) {
+            lfreq[syms[i].lit_or_len]++;
+        } else {
+            lfreq[257 + deflate_len_code(syms[i].lit_or_len)]++;
+            dfreq[deflate_dist_code(syms[i].dist)]++;
+        }
+    }
+    lfreq[256] = 1;
+
+    // dynamic trees
+    unsigned char llen[286], dlen[30];
+    deflate_build_lengths(lfreq, 286, 15, llen);
+    deflate_build_lengths(dfreq, 30, 15, dlen);
+    int hlit = 286;
+    while (hlit > 257 && llen[hlit - 1] == 0) hlit--;
+    int hdist = 30;
+    while (hdist > 1 && dlen[hdist - 1] == 0) hdist--;
+    if (dlen[0] == 0 && hdist == 1) dlen[0] = 1;  // at least one distance code must be sent
+
+    // run-length code the concatenated code lengths (symbols 16, 17, 18)
+    unsigned char all[286 + 30];
+    int nall = 0;
+    for (int i = 0; i < hlit; i++) all[nall++] = llen[i];
+    for (int i = 0; i < hdist; i++) all[nall++] = dlen[i];
+    unsigned char rle_sym[286 + 30];
+    unsigned char rle_extra[286 + 30];
+    int nrle = 0;
+    unsigned clfreq[19] = {0};
+    for (int i = 0; i < nall;) {
+        int run = 1;
+        while (i + run < nall && all[i + run] == all[i]) run++;
+        if (all[i] == 0 && run >= 3) {
+            if (run > 138) run = 138;
+            rle_sym[nrle] = (unsigned char)(run >= 11 ? 18 : 17);
+            rle_extra[nrle] = (unsigned char)(run >= 11 ? run - 11 : run - 3);
+            clfreq[rle_sym[nrle++]]++;
+            i += run;
+        } else if (all[i] != 0 && run >= 4) {
+            rle_sym[nrle] = all[i];
+            rle_extra[nrle] = 0;
+            clfreq[rle_sym[nrle++]]++;
+            int rep = run - 1;
+            if (rep > 6) rep = 6;
+            rle_sym[nrle] = 16;
+            rle_extra[nrle] = (unsigned char)(rep - 3);
+            clfreq[rle_sym[nrle++]]++;
+            i += 1 + rep;
+        } else {
+            rle_sym[nrle] = all[i];
+            rle_extra[nrle] = 0;
+            clfreq[rle_sym[nrle++]]++;
+            i++;
+        }
+    }
+    unsigned char cllen[19];
+    deflate_build_lengths(clfreq, 19, 7, cllen);
+    int hclen = 19;
+    while (hclen > 4 && cllen[deflate_cl_order[hclen - 1]] == 0) hclen--;
+
+    // compare encoded sizes (in bits)
+    unsigned long dyn_bits = 3 + 5 + 5 + 4 + 3UL * (unsigned long)hclen;
+    for (int i = 0; i < nrle; i++) {
+        dyn_bits += cllen[rle_sym[i]];
+        if (rle_sym[i] == 16) dyn_bits += 2;
+        if (rle_sym[i] == 17) dyn_bits += 3;
+        if (rle_sym[i] == 18) dyn_bits += 7;
+    }
+    unsigned long fix_bits = 3;
+    for (int i = 0; i < 286; i++) {
+        unsigned long extra = (i >= 257) ? deflate_len_extra[i - 257] : 0;
+        int fl = (i < 144) ? 8 : (i < 256) ? 9 : (i < 280) ? 7 : 8;
+        dyn_bits += lfreq[i] * (llen[i] + extra);
+        fix_bits += lfreq[i] * (fl + extra);
+    }
+    for (int i = 0; i < 30; i++) {
+        dyn_bits += dfreq[i] * (unsigned long)(dlen[i] + deflate_dist_extra[i]);
+        fix_bits += dfreq[i] * (unsigned long)(5 + deflate_dist_extra[i]);
+    }
+    unsigned long stored_bits = (len + 5 * (len / 65535 + 1)) * 8 + 8;
+
+    if (stored_bits <= dyn_bits && stored_bits <= fix_bits) {
+        deflate_write_stored(o, src, len, final);
+    } else if (fix_bits <= dyn_bits) {
+        unsigned char fl[288], fd[30];
+        unsigned lcode[288], dcode[30];
+        for (int i = 0; i < 288; i++) fl[i] = (unsigned char)((i < 144) ? 8 : (i < 256) ? 9 : (i < 280) ? 7 : 8);
+        for (int i = 0; i < 30; i++) fd[i] = 5;
+        deflate_build_codes(fl, 288, lcode);
+        deflate_build_codes(fd, 30, dcode);
+        deflate_put_bits(o, (unsigned long)final, 1);
+        deflate_put_bits(o, 1, 2);
+        deflate_write_symbols(o, syms, nsyms, lcode, fl, dcode, fd);
+    } else {
+        unsigned lcode[286], dcode[30], clcode[19];
+        deflate_build_codes(llen, 286, lcode);
+        deflate_build_codes(dlen, 30, dcode);
+        deflate_build_codes(cllen, 19, clcode);
+        deflate_put_bits(o, (unsigned long)final, 1);
+        deflate_put_bits(o, 2, 2);
+        deflate_put_bits(o, (unsigned long)(hlit - 257), 5);
+        deflate_put_bits(o, (unsigned long)(hdist - 1), 5);
+        deflate_put_bits(o, (unsigned long)(hclen - 4), 4);
+        for (int i = 0; i < hclen; i++) deflate_put_bits(o, cllen[deflate_cl_order[i]], 3);
+        for (int i = 0; i < nrle; i++) {
+            deflate_put_bits(o, clcode[rle_sym[i]], cllen[rle_sym[i]]);
+            if (rle_sym[i] == 16) deflate_put_bits(o, rle_extra[i], 2);
+            if (rle_sym[i] == 17) deflate_put_bits(o, rle_extra[i], 3);
+            if (rle_sym[i] == 18) deflate_put_bits(o, rle_extra[i], 7);
+        }
+        deflate_write_symbols(o, syms, nsyms, lcode, llen, dcode, dlen);
+    }
+}
+
+static unsigned deflate_hash(const unsigned char *p) {
+    return ((unsigned)p[0] << 10 ^ (unsigned)p[1] << 5 ^ (unsigned)p[2]) & ((1u << DEFLATE_HASH_BITS) - 1);
+}
+
+// Add position pos to the hash chains
+static void deflate_insert(const unsigned char *src, size_t len, size_t pos, int *head, int *prev) {
+    if (pos + DEFLATE_MIN_MATCH > len) return;
+    unsigned h = deflate_hash(src + pos);
+    prev[pos & (DEFLATE_WINDOW - 1)] = head[h];
+    head[h] = (int)pos;
+}
+
+// Length of the longest match for position pos (0 if shorter than DEFLATE_MIN_MATCH)
+// The search stops early once a match of nice_len bytes is found.
+static int deflate_longest_match(const unsigned char *src, size_t len, size_t pos,
+                                 const int *head, const int *prev, int max_chain, int nice_len, int *match_dist) {
+    int best = 0;
+    size_t max_len = len - pos;
+    if (max_len > DEFLATE_MAX_MATCH) max_len = DEFLATE_MAX_MATCH;
+    if (max_len < DEFLATE_MIN_MATCH) return 0;
+    int cand = head[deflate_hash(src + pos)];
+    while (cand >= 0 && max_chain-- > 0) {
+        size_t dist = pos - (size_t)cand;
+        if (dist > DEFLATE_WINDOW) break;
+        if (src[cand + best] == src[pos + best]) {
+            size_t l = 0;
+            while (l < max_len && src[cand + l] == src[pos + l]) l++;
+            if ((int)l > best) {
+                best = (int)l;
+                *match_dist = (int)dist;
+                if (l == max_len || (int)l >= nice_len) break;
+            }
+        }
+        cand = prev[cand & (DEFLATE_WINDOW - 1)];
+    }
+    return best >= DEFLATE_MIN_MATCH ? best : 0;
+}
+
+// Compress src into a zlib stream. level 0 stores, 1 (fastest) to 9 (best).
+// Returns a malloc'd buffer and its length in *out_len.
+unsigned char *deflate_zlib(const unsigned char *src, size_t len, int level, size_t *out_len) {
+    static const int chain_for_level[10] = {0, 4, 8, 16, 32, 64, 128, 256, 1024, 4096};
+    static const int nice_for_level[10] = {0, 16, 32, 64, 64, 128, 128, 128, 258, 258};
+    deflate_out o = {0};
+    if (level < 0) level = 6;
+    if (level > 9) level = 9;
+    // zlib header: deflate, 32K window, FLEVEL from the compression level
+    int flevel = level == 0 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3;
+    unsigned cmf = 0x78;
+    unsigned flg = (unsigned)flevel << 6;
+    flg += 31 - ((cmf << 8) + flg) % 31;
+    deflate_put_byte(&o, (unsigned char)cmf);
+    deflate_put_byte(&o, (unsigned char)flg);
+
+    if (level == 0 || len == 0) {
+        deflate_write_stored(&o, src, len, 1);
+    } else {
+        int max_chain = chain_for_level[level];
+        int nice_len = nice_for_level[level];
+        int lazy = level >= 4;
+        int *head = (int*)malloc(sizeof(int) << DEFLATE_HASH_BITS);
+        int *prev = (int*)malloc(sizeof(int) * DEFLATE_WINDOW);
+        deflate_sym *syms = (deflate_sym*)malloc(sizeof(deflate_sym) * DEFLATE_BLOCK_SYMS);
+        for (int i = 0; i < (1 << DEFLATE_HASH_BITS); i++) head[i] = -1;
+        size_t pos = 0;
+        size_t block_start = 0;
+        int nsyms = 0;
+        while (pos < len) {
+            int dist = 0;
+            int mlen = deflate_longest_match(src, len, pos, head, prev, max_chain, nice_len, &dist);
+            deflate_insert(src, len, pos, head, prev);
+            if (mlen && lazy && mlen < DEFLATE_MAX_MATCH) {
+                // emit a literal instead if a longer match starts at the next byte
+                int dist2 = 0;
+                if (deflate_longest_match(src, len, pos + 1, head, prev, max_chain, nice_len, &dist2) > mlen) mlen = 0;
+            }
+            if (mlen) {
+                syms[nsyms].lit_or_len = (unsigned short)mlen;
+                syms[nsyms].dist = (unsigned short)dist;
+                for (size_t k = pos + 1; k < pos + (size_t)mlen; k++) deflate_insert(src, len, k, head, prev);
+                pos += (size_t)mlen;
+            } else {
+                syms[nsyms].lit_or_len = src[pos];
+                syms[nsyms].dist = 0;
+                pos++;
+            }
+            nsyms++;
+            if (nsyms == DEFLATE_BLOCK_SYMS || pos >= len) {
+                deflate_write_block(&o, syms, nsyms, src + block_start, pos - block_start, pos >= len);
+                block_start = pos;
+                nsyms = 0;
+            }
+        }
+        free(head);
+        free(prev);
+        free(syms);
+    }
+    deflate_align(&o);
+
+    // Adler-32 checksum of the uncompressed data, big-endian
+    unsigned long a = 1, b = 0;
+    for (size_t i = 0; i < len; i++) {
+        a = (a + src[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    unsigned long adler = (b << 16) | a;
+    deflate_put_byte(&o, (unsigned char)(adler >> 24));
+    deflate_put_byte(&o, (unsigned char)(adler >> 16));
+    deflate_put_byte(&o, (unsigned char)(adler >> 8));
+    deflate_put_byte(&o, (unsigned char)adler);
+    *out_len = o.len;
+    return o.data;
+}
+
+#endif // DEFLATE_H
@@ -0,0 +1,152 @@
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// --- Page display list ---
+// What the emulators print on a page is recorded here and only turned into
+// output (PDF content, page image or SVG) when the page is finished. Dots
+// and glyphs are kept as structures of arrays in printing order, so a
+// writer (or a transform such as sorting or deduplication) walks each field
+// as one contiguous array. The page background is a single reference.
+//
+// Coordinates are points with the origin at the bottom-left corner of the
+// page, as in the writers. Dots, by far the most numerous, are stored in 6
+// bytes: a 16-bit position on a 1/DL_UNITS_PER_INCH inch grid in each axis,
+// which holds every carriage step of both printers exactly (1/60, 1/72,
+// 1/120, 1/216, 1/240 in), plus the needle and a radius index.
+
+#define DL_NEEDLE_NONE 255                    // dot not struck by a print head needle
+#define DL_FONT_TTF -1                        // glyph of the embedded TrueType font (1403)
+#define DL_SHADE_NONE -1                      // glyph drawn in black, no vintage shade
+#define DL_BG_NONE -2                         // page without tractor edges or guide bands
+#define DL_BG_INLINE -1                       // background drawn from the page geometry
+#define DL_MAX_RADII 256                      // distinct dot radii on a page (dot_radius is a byte)
+#define DL_UNITS_PER_INCH 4320                // dot position grid
+#define DL_UNITS_PER_PT (DL_UNITS_PER_INCH / 72)
+#define DL_ORIGIN (DL_UNITS_PER_INCH / 8)     // grid position of the page corner
+
+typedef struct {
+    // dots
+    int dots;
+    int dot_cap;
+    unsigned short *dot_x;                    // center, grid units from DL_ORIGIN
+    unsigned short *dot_y;
+    unsigned char *dot_needle;                // print head needle (0-8) or DL_NEEDLE_NONE
+    unsigned char *dot_radius;                // index into radius
+    float *radius;                            // dot radii (points)
+    int radii;
+    int radius_cap;
+    int radius_overflow;                      // more than DL_MAX_RADII radii were drawn
+
+    // glyphs
+    int glyphs;
+    int glyph_cap;
+    float *glyph_x;                           // origin of the glyph cell
+    float *glyph_y;
+    short *glyph_font;                        // Type3 variant or DL_FONT_TTF
+    unsigned char *glyph_code;
+    float *glyph_drop;                        // baseline lowered by (points, TrueType glyphs)
+    float *glyph_advance;                     // printer pitch (points, TrueType glyphs)
+    signed char *glyph_shade;                 // vintage palette entry or DL_SHADE_NONE
+
+    // background XObject variant, DL_BG_INLINE or DL_BG_NONE
+    int background;
+} dl_page;
+
+// The page being printed
+static dl_page dl_current = {0};
+
+// Empty page d, keeping its arrays for reuse
+static void dl_clear(dl_page *d, int background) {
+    d->dots = 0;
+    d->radii = 0;
+    d->radius_overflow = 0;
+    d->glyphs = 0;
+    d->background = background;
+}
+
+static void *dl_grow(void *p, int cap, size_t size) {
+    return realloc(p, (size_t)cap * size);
+}
+
+// Position of dot i (points)
+static inline float dl_dot_x(const dl_page *d, int i) {
+    return (float)((int)d->dot_x[i] - DL_ORIGIN) / DL_UNITS_PER_PT;
+}
+
+static inline float dl_dot_y(const dl_page *d, int i) {
+    return (float)((int)d->dot_y[i] - DL_ORIGIN) / DL_UNITS_PER_PT;
+}
+
+// Add a dot of radius r centered at (x, y) struck by needle. The grid
+// reaches 1/8 in beyond the bottom and left edges of the page and past the
+// widest media; a dot centered further out leaves no ink on the page and
+// is not recorded.
+static void dl_add_dot(dl_page *d, float x, float y, float r, int needle) {
+    float gx = x * DL_UNITS_PER_PT + DL_ORIGIN;
+    float gy = y * DL_UNITS_PER_PT + DL_ORIGIN;
+    if (gx < 0.0f || gy < 0.0f || gx > 65535.0f || gy > 65535.0f) return;
+    if (d->dots == d->dot_cap) {
+        d->dot_cap = d->dot_cap ? d->dot_cap * 2 : 4096;
+        d->dot_x = (unsigned short*)dl_grow(d->dot_x, d->dot_cap, sizeof(unsigned short));
+        d->dot_y = (unsigned short*)dl_grow(d->dot_y, d->dot_cap, sizeof(unsigned short));
+        d->dot_needle = (unsigned char*)dl_grow(d->dot_needle, d->dot_cap, 1);
+        d->dot_radius = (unsigned char*)dl_grow(d->dot_radius, d->dot_cap, 1);
+    }
+    int k = 0;
+    while (k < d->radii && d->radius[k] != r) k++;
+    if (k == d->radii && d->radii == DL_MAX_RADII) {
+        // no index left: draw it with the closest radius and say so once per page
+        float best = -1.0f;
+        for (int j = 0; j < d->radii; j++) {
+            float e = d->radius[j] > r ? d->radius[j] - r : r - d->radius[j];
+            if (best < 0.0f || e < best) {
+                best = e;
+                k = j;
+            }
+        }
+        if (!d->radius_overflow) {
+            fprintf(stderr, "Warning: more than %d dot sizes on a page, drawing %.3f pt dots as %.3f pt\n",
+                    DL_MAX_RADII, r, d->radius[k]);
+            d->radius_overflow = 1;
+        }
+    } else if (k == d->radii) {
+        if (d->radii == d->radius_cap) {
+            d->radius_cap = d->radius_cap ? d->radius_cap * 2 : 16;
+            d->radius = (float*)dl_grow(d->radius, d->radius_cap, sizeof(float));
+        }
+        d->radius[d->radii++] = r;
+    }
+    int i = d->dots++;
+    d->dot_x[i] = (unsigned short)(gx + 0.5f);
+    d->dot_y[i] = (unsigned short)(gy + 0.5f);
+    d->dot_needle[i] = (unsigned char)(needle >= 0 && needle < DL_NEEDLE_NONE ? needle : DL_NEEDLE_NONE);
+    d->dot_radius[i] = (unsigned char)k;
+}
+
+// Add glyph code of font with its origin at (x, y)
+static void dl_add_glyph(dl_page *d, int font, int code, float x, float y, float drop, float advance, int shade) {
+    if (d->glyphs == d->glyph_cap) {
+        d->glyph_cap = d->glyph_cap ? d->glyph_cap * 2 : 1024;
+        d->glyph_x = (float*)dl_grow(d->glyph_x, d->glyph_cap, sizeof(float));
+        d->glyph_y = (float*)dl_grow(d->glyph_y, d->glyph_cap, sizeof(float));
+        d->glyph_font = (short*)dl_grow(d->glyph_font, d->glyph_cap, sizeof(short));
+        d->glyph_code = (unsigned char*)dl_grow(d->glyph_code, d->glyph_cap, 1);
+        d->glyph_drop = (float*)dl_grow(d->glyph_drop, d->glyph_cap, sizeof(float));
+        d->glyph_advance = (float*)dl_grow(d->glyph_advance, d->glyph_cap, sizeof(float));
+        d->glyph_shade = (signed char*)dl_grow(d->glyph_shade, d->glyph_cap, 1);
+    }
+    int i = d->glyphs++;
+    d->glyph_x[i] = x;
+    d->glyph_y[i] = y;
+    d->glyph_font[i] = (short)font;
+    d->glyph_code[i] = (unsigned char)code;
+    d->glyph_drop[i] = drop;
+    d->glyph_advance[i] = advance;
+    d->glyph_shade[i] = (signed char)shade;
+}
+
+#endif // DISPLAY_H
@@ -0,0 +1,211 @@
+#ifndef DOTFMT_H
+#define DOTFMT_H
+
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define DOTFMT_AVX2 1
+#endif
+
+#include "display.h"
+
+// --- Batch formatting of dot positions ---
+// Stroked dots ("x y m x y l") make up most of a graphics page, and their
+// positions come straight from the display list grid, where a point is 60
+// units. A coordinate is written as its whole points followed by the
+// sixtieths rounded to three decimals, the same text pdf_fmt_num produces.
+// The split into points and sixtieths and the decimal digits of the points
+// are computed with 16-bit fixed-point arithmetic for eight positions at a
+// time with SSE2, or sixteen with AVX2 when the processor has it; the text
+// is then assembled from the digits and a table of the 60 fractions.
+
+#if DL_UNITS_PER_PT != 60
+#error "dotfmt.h expects 60 grid units per point"
+#endif
+
+#define DOTFMT_BLOCK 64                       // positions split at a time
+#define DOTFMT_DOT_MAX 48                     // longest "x y m x y l\n"
+
+// A block of positions split for output
+typedef struct {
+    unsigned char digits[DOTFMT_BLOCK * 4];   // whole points, four digits each, leading zeros
+    unsigned short len[DOTFMT_BLOCK];         // significant digits of the whole points
+    unsigned short rem[DOTFMT_BLOCK];         // sixtieths of a point
+    unsigned short neg[DOTFMT_BLOCK];         // nonzero left of or below the page corner
+} dotfmt_split;
+
+static char dotfmt_frac[60][4];               // ".ddd" with trailing zeros dropped
+static unsigned char dotfmt_frac_len[60];
+static int dotfmt_ready = 0;
+static void (*dotfmt_split_block)(const unsigned short *v, dotfmt_split *s);
+
+// Split position v (grid units) into s at i
+static inline void dotfmt_split_one(unsigned v, dotfmt_split *s, int i) {
+    unsigned a = v >= DL_ORIGIN ? v - DL_ORIGIN : DL_ORIGIN - v;
+    unsigned q = a / 60;
+    s->rem[i] = (unsigned short)(a - q * 60);
+    s->neg[i] = v < DL_ORIGIN;
+    s->len[i] = (unsigned short)(1 + (q > 9) + (q > 99) + (q > 999));
+    s->digits[i * 4] = (unsigned char)('0' + q / 1000);
+    s->digits[i * 4 + 1] = (unsigned char)('0' + q / 100 % 10);
+    s->digits[i * 4 + 2] = (unsigned char)('0' + q / 10 % 10);
+    s->digits[i * 4 + 3] = (unsigned char)('0' + q % 10);
+}
+
+static void dotfmt_split_scalar(const unsigned short *v, dotfmt_split *s) {
+    for (int i = 0; i < DOTFMT_BLOCK; i++) dotfmt_split_one(v[i], s, i);
+}
+
+// The vector versions divide with a multiply by a 16-bit reciprocal:
+// (a * 34953) >> 21 is a / 60 for every a below 65536, (q * 8389) >> 23 is
+// q / 1000, (t * 656) >> 16 is t / 100 and (u * 6554) >> 16 is u / 10 over
+// the ranges they are used on.
+#ifdef __SSE2__
+static void dotfmt_split_sse2(const unsigned short *v, dotfmt_split *s) {
+    const __m128i origin = _mm_set1_epi16((short)DL_ORIGIN);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ascii = _mm_set1_epi16('0');
+    for (int i = 0; i < DOTFMT_BLOCK; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(v + i));
+        __m128i below = _mm_subs_epu16(origin, x);
+        __m128i a = _mm_or_si128(_mm_subs_epu16(x, origin), below);
+        __m128i q = _mm_srli_epi16(_mm_mulhi_epu16(a, _mm_set1_epi16((short)34953)), 5);
+        __m128i r = _mm_sub_epi16(a, _mm_mullo_epi16(q, _mm_set1_epi16(60)));
+        __m128i d3 = _mm_srli_epi16(_mm_mulhi_epu16(q, _mm_set1_epi16(8389)), 7);
+        __m128i t = _mm_sub_epi16(q, _mm_mullo_epi16(d3, _mm_set1_epi16(1000)));
+        __m128i d2 = _mm_mulhi_epu16(t, _mm_set1_epi16(656));
+        __m128i u = _mm_sub_epi16(t, _mm_mullo_epi16(d2, _mm_set1_epi16(100)));
+        __m128i d1 = _mm_mulhi_epu16(u, _mm_set1_epi16(6554));
+        __m128i d0 = _mm_sub_epi16(u, _mm_mullo_epi16(d1, _mm_set1_epi16(10)));
+        // 1 plus one for each power of ten q reaches (compares give -1)
+        __m128i len = _mm_sub_epi16(_mm_set1_epi16(1), _mm_add_epi16(
+            _mm_add_epi16(_mm_cmpgt_epi16(q, _mm_set1_epi16(9)), _mm_cmpgt_epi16(q, _mm_set1_epi16(99))),
+            _mm_cmpgt_epi16(q, _mm_set1_epi16(999))));
+        // bytes d3 d2 d1 d0 for each position, in order
+        __m128i hi = _mm_or_si128(_mm_add_epi16(d3, ascii), _mm_slli_epi16(_mm_add_epi16(d2, ascii), 8));
+        __m128i lo = _mm_or_si128(_mm_add_epi16(d1, ascii), _mm_slli_epi16(_mm_add_epi16(d0, ascii), 8));
+        _mm_storeu_si128((__m128i*)(s->digits + i * 4), _mm_unpacklo_epi16(hi, lo));
+        _mm_storeu_si128((__m128i*)(s->digits + i * 4 + 16), _mm_unpackhi_epi16(hi, lo));
+        _mm_storeu_si128((__m128i*)(s->len + i), len);
+        _mm_storeu_si128((__m128i*)(s->rem + i), r);
+        _mm_storeu_si128((__m128i*)(s->neg + i), _mm_andnot_si128(_mm_cmpeq_epi16(below, zero), _mm_set1_epi16(1)));
+    }
+}
+#endif
+
+#ifdef DOTFMT_AVX2
+__attribute__((target("avx2")))
+static void dotfmt_split_avx2(const unsigned short *v, dotfmt_split *s) {
+    const __m256i origin = _mm256_set1_epi16((short)DL_ORIGIN);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ascii = _mm256_set1_epi16('0');
+    for (int i = 0; i < DOTFMT_BLOCK; i += 16) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(v + i));
+        __m256i below = _mm256_subs_epu16(origin, x);
+        __m256i a = _mm256_or_si256(_mm256_subs_epu16(x, origin), below);
+        __m256i q = _mm256_srli_epi16(_mm256_mulhi_epu16(a, _mm256_set1_epi16((short)34953)), 5);
+        __m256i r = _mm256_sub_epi16(a, _mm256_mullo_epi16(q, _mm256_set1_epi16(60)));
+        __m256i d3 = _mm256_srli_epi16(_mm256_mulhi_epu16(q, _mm256_set1_epi16(8389)), 7);
+        __m256i t = _mm256_sub_epi16(q, _mm256_mullo_epi16(d3, _mm256_set1_epi16(1000)));
+        __m256i d2 = _mm256_mulhi_epu16(t, _mm256_set1_epi16(656));
+        __m256i u = _mm256_sub_epi16(t, _mm256_mullo_epi16(d2, _mm256_set1_epi16(100)));
+        __m256i d1 = _mm256_mulhi_epu16(u, _mm256_set1_epi16(6554));
+        __m256i d0 = _mm256_sub_epi16(u, _mm256_mullo_epi16(d1, _mm256_set1_epi16(10)));
+        __m256i len = _mm256_sub_epi16(_mm256_set1_epi16(1), _mm256_add_epi16(
+            _mm256_add_epi16(_mm256_cmpgt_epi16(q, _mm256_set1_epi16(9)), _mm256_cmpgt_epi16(q, _mm256_set1_epi16(99))),
+            _mm256_cmpgt_epi16(q, _mm256_set1_epi16(999))));
+        __m256i hi = _mm256_or_si256(_mm256_add_epi16(d3, ascii), _mm256_slli_epi16(_mm256_add_epi16(d2, ascii), 8));
+        __m256i lo = _mm256_or_si256(_mm256_add_epi16(d1, ascii), _mm256_slli_epi16(_mm256_add_epi16(d0, ascii), 8));
+        // the unpacks work within 128-bit lanes: positions 0-3 and 8-11, then 4-7 and 12-15
+        __m256i ulo = _mm256_unpacklo_epi16(hi, lo);
+        __m256i uhi = _mm256_unpackhi_epi16(hi, lo);
+        _mm256_storeu_si256((__m256i*)(s->digits + i * 4), _mm256_permute2x128_si256(ulo, uhi, 0x20));
+        _mm256_storeu_si256((__m256i*)(s->digits + i * 4 + 32), _mm256_permute2x128_si256(ulo, uhi, 0x31));
+        _mm256_storeu_si256((__m256i*)(s->len + i), len);
+        _mm256_storeu_si256((__m256i*)(s->rem + i), r);
+        _mm256_storeu_si256((__m256i*)(s->neg + i), _mm256_andnot_si256(_mm256_cmpeq_epi16(below, zero), _mm256_set1_epi16(1)));
+    }
+}
+#endif
+
+// Build the fraction table and pick the widest splitter the processor runs
+static void dotfmt_init() {
+    for (int r = 0; r < 60; r++) {
+        // sixtieths never fall on a half millipoint, so this rounds like pdf_fmt_num
+        unsigned milli = (unsigned)(r * 50 + 1) / 3;
+        char *p = dotfmt_frac[r];
+        int n = 0;
+        if (milli) {
+            p[n++] = '.';
+            p[n++] = (char)('0' + milli / 100);
+            if (milli % 100) {
+                p[n++] = (char)('0' + milli / 10 % 10);
+                if (milli % 10) p[n++] = (char)('0' + milli % 10);
+            }
+        }
+        dotfmt_frac_len[r] = (unsigned char)n;
+    }
+    dotfmt_split_block = dotfmt_split_scalar;
+#ifdef __SSE2__
+    dotfmt_split_block = dotfmt_split_sse2;
+#endif
+#ifdef DOTFMT_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) dotfmt_split_block = dotfmt_split_avx2;
+#endif
+    dotfmt_ready = 1;
+}
+
+// Write split position i of s at p, followed by a space, and return the new end
+static inline char *dotfmt_put(char *p, const dotfmt_split *s, int i) {
+    int len = s->len[i];
+    *p = '-';
+    p += s->neg[i];
+    memcpy(p, s->digits + i * 4 + 4 - len, 4);
+    p += len;
+    memcpy(p, dotfmt_frac[s->rem[i]], 4);
+    p += dotfmt_frac_len[s->rem[i]];
+    *p++ = ' ';
+    return p;
+}
+
+// Write "x y m x y l\n" for the n dots at grid positions (x[i], y[i]) at p
+// (which has room for n * DOTFMT_DOT_MAX bytes) and return the new end
+static char *dotfmt_stroke(char *p, const unsigned short *x, const unsigned short *y, int n) {
+    static dotfmt_split sx, sy;
+    unsigned short bx[DOTFMT_BLOCK], by[DOTFMT_BLOCK];
+    if (!dotfmt_ready) dotfmt_init();
+    for (int start = 0; start < n; start += DOTFMT_BLOCK) {
+        int m = n - start < DOTFMT_BLOCK ? n - start : DOTFMT_BLOCK;
+        const unsigned short *px = x + start;
+        const unsigned short *py = y + start;
+        if (m < DOTFMT_BLOCK) {
+            // pad the last block
+            memset(bx, 0, sizeof(bx));
+            memset(by, 0, sizeof(by));
+            memcpy(bx, px, (size_t)m * sizeof(unsigned short));
+            memcpy(by, py, (size_t)m * sizeof(unsigned short));
+            px = bx;
+            py = by;
+        }
+        dotfmt_split_block(px, &sx);
+        dotfmt_split_block(py, &sy);
+        for (int i = 0; i < m; i++) {
+            char *xy = p;
+            p = dotfmt_put(p, &sx, i);
+            p = dotfmt_put(p, &sy, i);
+            size_t len = (size_t)(p - xy);
+            memcpy(p, "m ", 2);
+            memcpy(p + 2, xy, len);
+            p += 2 + len;
+            memcpy(p, "l\n", 2);
+            p += 2;
+        }
+    }
+    return p;
+}
+
+#endif // DOTFMT_H
@@ -0,0 +1,181 @@
+#ifndef G4_H
+#define G4_H
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// --- Self-contained CCITT Group 4 (ITU-T T.6) encoder ---
+// Used for bilevel TIFF pages. Every row is coded two-dimensionally
+// against the row above it (an all-white row for the first), with the
+// pass, vertical and horizontal modes; there are no EOL codes and the
+// image ends with EOFB. Rows are taken from an 8-bit grayscale buffer:
+// pixels darker than 128 are black. Bits are packed most significant
+// first (TIFF FillOrder 1).
+
+// Terminating codes for runs of 0-63 pixels: {code, length}
+static const unsigned short g4_white_term[64][2] = {
+    {0x035,  8}, {0x007,  6}, {0x007,  4}, {0x008,  4}, {0x00B,  4}, {0x00C,  4}, {0x00E,  4}, {0x00F,  4},
+    {0x013,  5}, {0x014,  5}, {0x007,  5}, {0x008,  5}, {0x008,  6}, {0x003,  6}, {0x034,  6}, {0x035,  6},
+    {0x02A,  6}, {0x02B,  6}, {0x027,  7}, {0x00C,  7}, {0x008,  7}, {0x017,  7}, {0x003,  7}, {0x004,  7},
+    {0x028,  7}, {0x02B,  7}, {0x013,  7}, {0x024,  7}, {0x018,  7}, {0x002,  8}, {0x003,  8}, {0x01A,  8},
+    {0x01B,  8}, {0x012,  8}, {0x013,  8}, {0x014,  8}, {0x015,  8}, {0x016,  8}, {0x017,  8}, {0x028,  8},
+    {0x029,  8}, {0x02A,  8}, {0x02B,  8}, {0x02C,  8}, {0x02D,  8}, {0x004,  8}, {0x005,  8}, {0x00A,  8},
+    {0x00B,  8}, {0x052,  8}, {0x053,  8}, {0x054,  8}, {0x055,  8}, {0x024,  8}, {0x025,  8}, {0x058,  8},
+    {0x059,  8}, {0x05A,  8}, {0x05B,  8}, {0x04A,  8}, {0x04B,  8}, {0x032,  8}, {0x033,  8}, {0x034,  8}
+};
+
+// Make-up codes for runs of 64-1728 pixels in steps of 64
+static const unsigned short g4_white_makeup[27][2] = {
+    {0x01B,  5}, {0x012,  5}, {0x017,  6}, {0x037,  7}, {0x036,  8}, {0x037,  8}, {0x064,  8}, {0x065,  8},
+    {0x068,  8}, {0x067,  8}, {0x0CC,  9}, {0x0CD,  9}, {0x0D2,  9}, {0x0D3,  9}, {0x0D4,  9}, {0x0D5,  9},
+    {0x0D6,  9}, {0x0D7,  9}, {0x0D8,  9}, {0x0D9,  9}, {0x0DA,  9}, {0x0DB,  9}, {0x098,  9}, {0x099,  9},
+    {0x09A,  9}, {0x018,  6}, {0x09B,  9}
+};
+
+static const unsigned short g4_black_term[64][2] = {
+    {0x037, 10}, {0x002,  3}, {0x003,  2}, {0x002,  2}, {0x003,  3}, {0x003,  4}, {0x002,  4}, {0x003,  5},
+    {0x005,  6}, {0x004,  6}, {0x004,  7}, {0x005,  7}, {0x007,  7}, {0x004,  8}, {0x007,  8}, {0x018,  9},
+    {0x017, 10}, {0x018, 10}, {0x008, 10}, {0x067, 11}, {0x068, 11}, {0x06C, 11}, {0x037, 11}, {0x028, 11},
+    {0x017, 11}, {0x018, 11}, {0x0CA, 12}, {0x0CB, 12}, {0x0CC, 12}, {0x0CD, 12}, {0x068, 12}, {0x069, 12},
+    {0x06A, 12}, {0x06B, 12}, {0x0D2, 12}, {0x0D3, 12}, {0x0D4, 12}, {0x0D5, 12}, {0x0D6, 12}, {0x0D7, 12},
+    {0x06C, 12}, {0x06D, 12}, {0x0DA, 12}, {0x0DB, 12}, {0x054, 12}, {0x055, 12}, {0x056, 12}, {0x057, 12},
+    {0x064, 12}, {0x065, 12}, {0x052, 12}, {0x053, 12}, {0x024, 12}, {0x037, 12}, {0x038, 12}, {0x027, 12},
+    {0x028, 12}, {0x058, 12}, {0x059, 12}, {0x02B, 12}, {0x02C, 12}, {0x05A, 12}, {0x066, 12}, {0x067, 12}
+};
+
+static const unsigned short g4_black_makeup[27][2] = {
+    {0x00F, 10}, {0x0C8, 12}, {0x0C9, 12}, {0x05B, 12}, {0x033, 12}, {0x034, 12}, {0x035, 12}, {0x06C, 13},
+    {0x06D, 13}, {0x04A, 13}, {0x04B, 13}, {0x04C, 13}, {0x04D, 13}, {0x072, 13}, {0x073, 13}, {0x074, 13},
+    {0x075, 13}, {0x076, 13}, {0x077, 13}, {0x052, 13}, {0x053, 13}, {0x054, 13}, {0x055, 13}, {0x05A, 13},
+    {0x05B, 13}, {0x064, 13}, {0x065, 13}
+};
+
+// Make-up codes for 1792-2560 pixels, shared by both colors
+static const unsigned short g4_ext_makeup[13][2] = {
+    {0x008, 11}, {0x00C, 11}, {0x00D, 11}, {0x012, 12}, {0x013, 12}, {0x014, 12}, {0x015, 12}, {0x016, 12},
+    {0x017, 12}, {0x01C, 12}, {0x01D, 12}, {0x01E, 12}, {0x01F, 12}
+};
+
+typedef struct {
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+    unsigned long bits;                       // pending bits (MSB first)
+    int nbits;
+} g4_out;
+
+static void g4_put_bits(g4_out *o, unsigned code, int n) {
+    o->bits = (o->bits << n) | code;
+    o->nbits += n;
+    while (o->nbits >= 8) {
+        if (o->len + 1 > o->cap) {
+            o->cap = o->cap ? o->cap * 2 : 4096;
+            o->data = (unsigned char*)realloc(o->data, o->cap);
+        }
+        o->nbits -= 8;
+        o->data[o->len++] = (unsigned char)(o->bits >> o->nbits);
+    }
+    o->bits &= (1UL << o->nbits) - 1;
+}
+
+// Code a run of n pixels of color (0 = white, 1 = black)
+static void g4_put_run(g4_out *o, int n, int color) {
+    while (n >= 2560) {
+        g4_put_bits(o, g4_ext_makeup[12][0], g4_ext_makeup[12][1]);
+        n -= 2560;
+    }
+    if (n >= 1792) {
+        g4_put_bits(o, g4_ext_makeup[(n - 1792) / 64][0], g4_ext_makeup[(n - 1792) / 64][1]);
+        n &= 63;
+    } else if (n >= 64) {
+        const unsigned short *m = color ? g4_black_makeup[n / 64 - 1] : g4_white_makeup[n / 64 - 1];
+        g4_put_bits(o, m[0], m[1]);
+        n &= 63;
+    }
+    const unsigned short *t = color ? g4_black_term[n] : g4_white_term[n];
+    g4_put_bits(o, t[0], t[1]);
+}
+
+// Changing elements of a row: positions where the color differs from the
+// pixel to the left (the pixel left of the row is white). Even entries
+// start black runs, odd entries white runs. The list is terminated with
+// width three times so lookups past the end need no checks. Returns the
+// number of changes.
+static int g4_row_changes(const unsigned char *row, int width, int *changes) {
+    int n = 0;
+    int black = 0;
+    int x = 0;
+    while (x < width) {
+#ifdef __SSE2__
+        // skip sixteen pixels at a time while they match the current color
+        // (the sign bit of each byte is set for white)
+        int same = black ? 0x0000 : 0xFFFF;
+        while (x + 16 <= width && _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(row + x))) == same) x += 16;
+        if (x >= width) break;
+#endif
+        if ((row[x] < 128) != black) {
+            changes[n++] = x;
+            black = !black;
+        }
+        x++;
+    }
+    changes[n] = changes[n + 1] = changes[n + 2] = width;
+    return n;
+}
+
+// Compress the width x height image at gray (rows stride bytes apart).
+// Returns a malloc'd buffer and its length in *out_len.
+unsigned char *g4_encode(const unsigned char *gray, int width, int height, size_t stride, size_t *out_len) {
+    g4_out o = {0};
+    int *ref = (int*)malloc(sizeof(int) * (width + 4));
+    int *cur = (int*)malloc(sizeof(int) * (width + 4));
+    ref[0] = ref[1] = ref[2] = width;         // imaginary white row above the image
+    for (int y = 0; y < height; y++) {
+        g4_row_changes(gray + (size_t)y * stride, width, cur);
+        int a0 = -1;
+        int black = 0;                        // color of a0
+        int i = 0;                            // first change in cur after a0
+        int j = 0;                            // first change in ref after a0
+        while (a0 < width) {
+            while (cur[i] <= a0) i++;
+            while (ref[j] <= a0) j++;
+            int a1 = cur[i];
+            // b1: next change in ref to the color opposite a0's (even entries turn black)
+            int jb = j + ((j & 1) != black);
+            int b1 = ref[jb];
+            int b2 = ref[jb + 1];
+            if (b2 < a1) {
+                g4_put_bits(&o, 0x1, 4);      // pass
+                a0 = b2;
+            } else if (a1 - b1 <= 3 && b1 - a1 <= 3) {
+                static const unsigned short vertical[7][2] = {
+                    {0x02, 7}, {0x02, 6}, {0x2, 3}, {0x1, 1}, {0x3, 3}, {0x03, 6}, {0x03, 7}
+                };
+                g4_put_bits(&o, vertical[a1 - b1 + 3][0], vertical[a1 - b1 + 3][1]);
+                a0 = a1;
+                black = !black;
+            } else {
+                int a2 = cur[i + 1];
+                g4_put_bits(&o, 0x1, 3);      // horizontal
+                g4_put_run(&o, a1 - (a0 < 0 ? 0 : a0), black);
+                g4_put_run(&o, a2 - a1, !black);
+                a0 = a2;
+            }
+        }
+        int *t = ref;
+        ref = cur;
+        cur = t;
+    }
+    g4_put_bits(&o, 0x001, 12);               // EOFB
+    g4_put_bits(&o, 0x001, 12);
+    if (o.nbits > 0) g4_put_bits(&o, 0, 8 - o.nbits);
+    free(ref);
+    free(cur);
+    *out_len = o.len;
+    return o.data;
+}
+
+#endif // G4_H
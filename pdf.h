@@ -6,6 +6,13 @@
 #include <stdarg.h>
 #include <string.h>
 
+#include "deflate.h"
+#include "ttf.h"
+#include "raster.h"
+#include "svg.h"
+#include "display.h"
+#include "dotfmt.h"
+
 // External declarations
 extern int draw_tractor_edges;
 extern int draw_guide_strips;
@@ -18,6 +25,18 @@ extern int page_lpi;
 // Vintage emulation: current intensity multiplier (1.0 = normal)
 extern int vintage_enabled;
 extern float vintage_current_intensity;
+// Dot encoding used by pdf_draw_dot_inch (DOT_STYLE_*)
+extern int dot_style;
+// Flate level for streams (-1 = uncompressed, 0 = store ... 9 = best)
+extern int pdf_compress_level;
+// Device units per inch for content coordinates (0 = points with decimals)
+extern int pdf_units;
+// PDF 1.5 output: dictionaries packed into object streams, xref stream
+extern int pdf_object_streams;
+// Linearized ("fast web view") output
+extern int pdf_linearize;
+// Overprint tolerance (inches): dots landing on an already inked cell are dropped (0 = off)
+extern float dot_overprint_tolerance;
 
 // Tractor constants
 #define TRACTOR_WIDTH_IN 0.5f                 // width of each tractor strip (inches)
@@ -25,79 +44,596 @@ extern float vintage_current_intensity;
 #define TRACTOR_HOLE_MARGIN_IN 0.25f          // margin from edge to first hole (inches)
 #define TRACTOR_HOLE_RADIUS_PT 5.625f         // radius of tractor holes (points) (5/32" diameter => 0.078125in radius => 5.625pt)
 
+// Dot encodings
+#define DOT_STYLE_PATH 0                      // filled circle built from four Bezier curves (~150 bytes per dot)
+#define DOT_STYLE_STROKE 1                    // zero-length subpath stroked with a round cap (~30 bytes per dot)
+#define DOT_STYLE_XOBJECT 2                   // shared unit-circle Form XObject placed with 'cm' + 'Do'
+#define DOT_STROKE_BATCH 512                  // max dots collected into one path before it is stroked
+
 void pdf_draw_tractor_edges_page(void);
 int pdf_load_font(const char *font_file_path);
 
 // --- Lightweight multi-page PDF generation ---
-// We produce a small PDF with multiple pages. Dots are drawn as filled circles
-// approximated using four cubic Bezier curves.
+// We produce a small PDF with multiple pages. Dots are drawn either as filled
+// circles approximated using four cubic Bezier curves, or as zero-length
+// subpaths stroked with a round line cap (see DOT_STYLE_*).
+//
+// The drawing calls of the emulators (pdf_draw_dot_inch, pdf_draw_char,
+// pdf_draw_t3_glyph) record into the page's display list (display.h);
+// pdf_flush_page renders it into the selected output and writes the page.
+//
+// The document is streamed: pdf_init writes the header, every finished page
+// (form feed or automatic page break) is written out and its buffer reused,
+// and pdf_finish writes the shared objects, the Pages tree and the xref.
+// Only the current page is held in memory.
+//
+// pdf_init_append continues a document written earlier instead: the new
+// objects, a new version of the Pages tree and an xref section chained to
+// the previous one with /Prev are appended as an incremental update.
+
+extern int pdf_pages;         // pages started so far
+
+// Fixed object numbers; everything else is allocated as it is written
+#define PDF_OBJ_CATALOG 1
+#define PDF_OBJ_PAGES 2
+#define PDF_OBJ_RESOURCES 3                   // Resources dictionary shared by all pages
+
+// Output state. Offsets are tracked here rather than with ftell so the
+// output can be a pipe.
+static FILE *pdf_out = NULL;
+static long pdf_out_pos = 0;
+static long *pdf_obj_offsets = NULL;          // byte offset per object number
+static int pdf_obj_count = 0;                 // highest object number allocated
+static int pdf_obj_cap = 0;
+static int *pdf_page_objs = NULL;             // Page object numbers in page order (/Kids)
+static int *pdf_page_contents = NULL;         // content stream object of each page
+static int *pdf_obj_stms = NULL;              // object stream holding each object (0 = written directly)
+static FILE *pdf_lin_out = NULL;              // final output while writing the temporary file (linearized mode)
+static long pdf_xref_pos = 0;                 // offset of the xref table written by pdf_finish
+static long pdf_prev_xref = -1;               // xref of the section being updated (-1 = new document)
+static int pdf_resources_obj = PDF_OBJ_RESOURCES;  // Resources of the pages written in this section
+static int pdf_replace_page = 0;              // earlier Page object rewritten by the next page (0 = none)
+
+// Indirect references written to the temporary file (linearized mode): the
+// offset of each reference's object number and the object it names, in file
+// order, so the objects can be renumbered without parsing them
+static long *pdf_lin_ref_pos = NULL;
+static int *pdf_lin_ref_obj = NULL;
+static int pdf_lin_refs = 0;
+static int pdf_lin_ref_cap = 0;
 
-extern char **pdf_contents;   // per-page content buffers
-extern size_t *pdf_lens;
-extern size_t *pdf_caps;
-extern int pdf_pages;
+// Content buffer of the current page
+static char *pdf_page_data = NULL;
+static size_t pdf_page_len = 0;
+static size_t pdf_page_cap = 0;
+static int pdf_page_open = 0;
+
+// Content streams already written, for sharing identical page content.
+// Pages are identified by two independent 64-bit hashes and the length;
+// the table is open-addressed on the first hash.
+typedef struct {
+    unsigned long long h1, h2;
+    size_t len;
+    int obj;                                  // content stream object (0 = empty slot)
+} pdf_content_entry;
+static pdf_content_entry *pdf_contents = NULL;
+static size_t pdf_contents_cap = 0;           // slots, a power of two
+static size_t pdf_contents_count = 0;
+
+// Per-page dot occupancy grid for overprint removal (one bit per cell of
+// dot_overprint_tolerance inches, allocated on first use)
+#define PDF_OCC_MIN_CELL_IN 0.001f            // smallest cell, bounds the grid at ~20 MB
+static unsigned char *pdf_occ = NULL;
+static int pdf_occ_cols = 0;
+static int pdf_occ_rows = 0;
+static float pdf_occ_cell = 0.0f;
+static int pdf_occ_dirty = 0;                 // bits set since the grid was last cleared
+
+// Output units per point (see pdf_units); content streams are scaled back with a page-level 'cm'
+static float pdf_unit_scale = 1.0f;
+
+// Page backgrounds (tractor edges, guide bands): drawn once per page geometry
+// into a Form XObject and placed on each page with a single Do
+#define PDF_MAX_BACKGROUNDS 8
+typedef struct {
+    float width;                      // printable width (inches)
+    float height;                     // page height (inches)
+    int lpi;                          // band height for single-line guides (0 = not used)
+    int obj;                          // Form XObject number
+} pdf_background;
+static pdf_background pdf_backgrounds[PDF_MAX_BACKGROUNDS];
+static int pdf_background_count = 0;
 
 // Font data
 static char *font_data = NULL;
 static size_t font_data_len = 0;
 static char *font_path_used = NULL;
 static int font_needed = 0;  // Flag to track if font resources are needed
+static unsigned char font_used[256];  // character codes drawn with the font (for subsetting)
+static int dot_xobject_obj = 0;  // object number of the dot Form XObject (0 = not referenced yet)
+
+// Stroke state of the current page (DOT_STYLE_STROKE)
+static float pdf_line_width = -1.0f;  // line width last set with 'w' (-1 = not set on this page)
+static int pdf_stroke_pending = 0;    // dots appended to the open path but not yet stroked
+
+// Text object state of the current page (text runs)
+#define PDF_TEXT_NONE 0               // no text object open
+#define PDF_TEXT_OPEN 1               // inside BT ... ET, no TJ array open
+#define PDF_TEXT_STRING 2             // inside a '[(...' TJ array
+#define PDF_TEXT_F1 -2                // pdf_text_font value of the embedded TrueType font
+static int pdf_text_state = PDF_TEXT_NONE;
+static int pdf_text_font = -1;        // Type3 variant or PDF_TEXT_F1 selected with Tf (-1 = none)
+static float pdf_text_size = 1.0f;    // size of the selected font
+static float pdf_text_lx = 0.0f;      // start of the current text line (points, set by Td)
+static float pdf_text_ly = 0.0f;
+static long pdf_text_pen = 0;         // pen position relative to the line start (millipoints)
+// Text state kept across text objects until the end of the page
+static float pdf_text_tc = 0.0f;      // character spacing set with Tc (points, as written)
+static float pdf_text_rise = 0.0f;    // text rise set with Ts (points, as written)
+static int pdf_text_shade = -1;       // vintage palette entry set with sc (-1 = black DeviceGray fill)
+
+// Vintage ink intensities are quantized into a palette of gray shades, an
+// Indexed color space /VP in the shared resources, so a page selects the
+// color space once and then changes shade with a single 'N sc'
+#define PDF_VINTAGE_SHADES 8                  // palette entries, entry 0 is black
+#define PDF_VINTAGE_GRAY_MAX 0.3f             // gray of the last entry (faintest vintage column)
+static int pdf_vintage_palette = 0;   // palette referenced by some page
+
+void pdf_vappend(const char *fmt, va_list args);
+void pdf_raw_appendf(const char *fmt, ...);
+
+// Stroke any dots collected in the open path
+void pdf_flush_stroke() {
+    if (pdf_stroke_pending == 0) return;
+    pdf_stroke_pending = 0;
+    pdf_raw_appendf("S\n");
+}
+
+// Close any open text run and text object
+void pdf_flush_text() {
+    if (pdf_text_state == PDF_TEXT_NONE) return;
+    if (pdf_text_state == PDF_TEXT_STRING) pdf_raw_appendf(")] TJ\n");
+    pdf_raw_appendf("ET\n");
+    pdf_text_state = PDF_TEXT_NONE;
+    pdf_text_font = -1;
+    // glyph procedures may have changed the line width
+    pdf_line_width = -1.0f;
+    // other drawing expects a black fill
+    if (pdf_text_shade >= 0) {
+        pdf_raw_appendf("0 g\n");
+        pdf_text_shade = -1;
+    }
+}
+
+// Finish everything that is still being collected for the current page
+void pdf_flush_pending() {
+    pdf_flush_stroke();
+    pdf_flush_text();
+}
+
+void pdf_out_write(const void *data, size_t len) {
+    if (len == 0) return;
+    fwrite(data, 1, len, pdf_out);
+    pdf_out_pos += (long)len;
+}
+
+void pdf_out_printf(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vfprintf(pdf_out, fmt, args);
+    va_end(args);
+    if (n > 0) pdf_out_pos += n;
+}
+
+// Allocate the next object number
+int pdf_alloc_obj() {
+    pdf_obj_count++;
+    if (pdf_obj_count >= pdf_obj_cap) {
+        pdf_obj_cap = pdf_obj_cap ? pdf_obj_cap * 2 : 64;
+        pdf_obj_offsets = (long*)realloc(pdf_obj_offsets, sizeof(long) * pdf_obj_cap);
+        pdf_obj_stms = (int*)realloc(pdf_obj_stms, sizeof(int) * pdf_obj_cap);
+    }
+    pdf_obj_offsets[pdf_obj_count] = 0;
+    pdf_obj_stms[pdf_obj_count] = 0;
+    return pdf_obj_count;
+}
+
+// Record the offset of object id and write its header
+void pdf_begin_obj(int id) {
+    pdf_obj_offsets[id] = pdf_out_pos;
+    pdf_out_printf("%d 0 obj\n", id);
+}
+
+// Write an indirect reference to object id, noting where it is when the
+// document will be linearized
+void pdf_out_ref(int id) {
+    if (pdf_lin_out) {
+        if (pdf_lin_refs == pdf_lin_ref_cap) {
+            pdf_lin_ref_cap = pdf_lin_ref_cap ? pdf_lin_ref_cap * 2 : 256;
+            pdf_lin_ref_pos = (long*)realloc(pdf_lin_ref_pos, sizeof(long) * pdf_lin_ref_cap);
+            pdf_lin_ref_obj = (int*)realloc(pdf_lin_ref_obj, sizeof(int) * pdf_lin_ref_cap);
+        }
+        pdf_lin_ref_pos[pdf_lin_refs] = pdf_out_pos;
+        pdf_lin_ref_obj[pdf_lin_refs++] = id;
+    }
+    pdf_out_printf("%d 0 R", id);
+}
+
+void pdf_write_stream_obj(int id, const char *extra, const void *data, size_t len);
+void pdf_begin_stream_obj(int id);
+void pdf_end_stream_obj(const void *data, size_t len, int level);
+void pdf_begin_dict(int id);
+void pdf_obj_printf(const char *fmt, ...);
+void pdf_obj_ref(int id);
+void pdf_end_dict(void);
+
+// Find the content stream slot for data: the slot holding identical content,
+// or the empty slot where it belongs
+static pdf_content_entry *pdf_content_slot(const char *data, size_t len) {
+    // FNV-1a and a multiplicative hash over the same bytes
+    unsigned long long h1 = 14695981039346656037ULL, h2 = (unsigned long long)len;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)data[i];
+        h1 = (h1 ^ c) * 1099511628211ULL;
+        h2 = (h2 + c + 1) * 0x9E3779B97F4A7C15ULL;
+        h2 ^= h2 >> 29;
+    }
+    if (pdf_contents_count * 2 >= pdf_contents_cap) {
+        // grow to keep the table at most half full
+        size_t old_cap = pdf_contents_cap;
+        pdf_content_entry *old = pdf_contents;
+        pdf_contents_cap = old_cap ? old_cap * 2 : 64;
+        pdf_contents = (pdf_content_entry*)calloc(pdf_contents_cap, sizeof(pdf_content_entry));
+        for (size_t i = 0; i < old_cap; i++) {
+            if (!old[i].obj) continue;
+            size_t k = (size_t)old[i].h1 & (pdf_contents_cap - 1);
+            while (pdf_contents[k].obj) k = (k + 1) & (pdf_contents_cap - 1);
+            pdf_contents[k] = old[i];
+        }
+        free(old);
+    }
+    size_t k = (size_t)h1 & (pdf_contents_cap - 1);
+    while (pdf_contents[k].obj) {
+        pdf_content_entry *e = &pdf_contents[k];
+        if (e->h1 == h1 && e->h2 == h2 && e->len == len) return e;
+        k = (k + 1) & (pdf_contents_cap - 1);
+    }
+    pdf_contents[k].h1 = h1;
+    pdf_contents[k].h2 = h2;
+    pdf_contents[k].len = len;
+    return &pdf_contents[k];
+}
+
+static void pdf_render_page(const dl_page *d);
+
+// Write the current page: its content stream, then its Page object. A page
+// whose content matches an earlier page (blank and separator pages) points
+// at the existing stream instead. Linearized output keeps one content
+// stream per page, as its hint tables require.
+void pdf_flush_page() {
+    if (!pdf_page_open) return;
+    pdf_render_page(&dl_current);
+    pdf_flush_pending();
+    if (raster_format || svg_output) {
+        if (raster_format) raster_flush_page();
+        else svg_flush_page();
+        pdf_page_len = 0;
+        pdf_page_open = 0;
+        return;
+    }
+    int page_obj = pdf_replace_page ? pdf_replace_page : pdf_alloc_obj();
+    pdf_replace_page = 0;
+    int content_obj;
+    pdf_content_entry *e = pdf_linearize ? NULL : pdf_content_slot(pdf_page_data, pdf_page_len);
+    if (e && e->obj) {
+        content_obj = e->obj;
+    } else {
+        content_obj = pdf_alloc_obj();
+        pdf_write_stream_obj(content_obj, "", pdf_page_data, pdf_page_len);
+        if (e) {
+            e->obj = content_obj;
+            pdf_contents_count++;
+        }
+    }
+    // Page width should be page_width (printable) or page_width+2*tractor when edges enabled
+    float media_width = draw_tractor_edges ? (page_width + (2.0f * TRACTOR_WIDTH_IN)) : page_width;
+    float w_pt = media_width * 72.0f;
+    float h_pt = page_height * 72.0f; // always 11 inches tall
+    pdf_begin_dict(page_obj);
+    pdf_obj_printf("<< /Type /Page /Parent ");
+    pdf_obj_ref(PDF_OBJ_PAGES);
+    pdf_obj_printf(" /MediaBox [0 0 %.3f %.3f] /Contents ", w_pt, h_pt);
+    pdf_obj_ref(content_obj);
+    pdf_obj_printf(" /Resources ");
+    pdf_obj_ref(pdf_resources_obj);
+    pdf_obj_printf(" >>");
+    pdf_end_dict();
+    pdf_page_objs = (int*)realloc(pdf_page_objs, sizeof(int) * pdf_pages);
+    pdf_page_objs[pdf_pages - 1] = page_obj;
+    pdf_page_contents = (int*)realloc(pdf_page_contents, sizeof(int) * pdf_pages);
+    pdf_page_contents[pdf_pages - 1] = content_obj;
+    // the buffer is kept for the next page
+    pdf_page_len = 0;
+    pdf_page_open = 0;
+    fflush(pdf_out);
+}
+
+// Return the background XObject for the current page geometry, writing it on
+// first use. Returns -1 if there are too many geometries (draw inline instead).
+int pdf_background_variant() {
+    int lpi = guide_single_line ? page_lpi : 0;
+    for (int i = 0; i < pdf_background_count; i++) {
+        pdf_background *b = &pdf_backgrounds[i];
+        if (b->width == page_width && b->height == page_height && b->lpi == lpi) return i;
+    }
+    if (pdf_background_count >= PDF_MAX_BACKGROUNDS) return -1;
+
+    // Draw into a scratch buffer in place of the page content
+    char *page_data = pdf_page_data;
+    size_t page_len = pdf_page_len;
+    size_t page_cap = pdf_page_cap;
+    pdf_page_data = NULL;
+    pdf_page_len = 0;
+    pdf_page_cap = 0;
+    if (dot_style == DOT_STYLE_STROKE) {
+        pdf_raw_appendf("1 J\n");
+    }
+    pdf_draw_tractor_edges_page();
+    pdf_flush_stroke();
+    pdf_line_width = -1.0f;
+    pdf_background *b = &pdf_backgrounds[pdf_background_count];
+    b->width = page_width;
+    b->height = page_height;
+    b->lpi = lpi;
+    b->obj = pdf_alloc_obj();
+    float media_width = draw_tractor_edges ? (page_width + (2.0f * TRACTOR_WIDTH_IN)) : page_width;
+    pdf_begin_stream_obj(b->obj);
+    pdf_out_printf("/Type /XObject /Subtype /Form /BBox [0 0 %.3f %.3f] /Resources ",
+                   media_width * 72.0f * pdf_unit_scale, page_height * 72.0f * pdf_unit_scale);
+    // the only resource a background can use is the dot XObject
+    if (dot_xobject_obj) {
+        pdf_out_printf("<< /XObject << /D ");
+        pdf_out_ref(dot_xobject_obj);
+        pdf_out_printf(" >> >> ");
+    } else {
+        pdf_out_printf("<< >> ");
+    }
+    pdf_end_stream_obj(pdf_page_data, pdf_page_len, pdf_compress_level);
+
+    free(pdf_page_data);
+    pdf_page_data = page_data;
+    pdf_page_len = page_len;
+    pdf_page_cap = page_cap;
+    return pdf_background_count++;
+}
 
 void pdf_new_page() {
-    // add a new empty page buffer
-    int new_pages = pdf_pages + 1;
-    pdf_contents = (char**)realloc(pdf_contents, sizeof(char*) * new_pages);
-    pdf_lens = (size_t*)realloc(pdf_lens, sizeof(size_t) * new_pages);
-    pdf_caps = (size_t*)realloc(pdf_caps, sizeof(size_t) * new_pages);
-    // initialize new page buffer
-    pdf_contents[pdf_pages] = NULL;
-    pdf_caps[pdf_pages] = 0;
-    pdf_lens[pdf_pages] = 0;
-    // ensure a small initial capacity
-    pdf_caps[pdf_pages] = 8192;
-    pdf_contents[pdf_pages] = (char*)malloc(pdf_caps[pdf_pages]);
-    pdf_lens[pdf_pages] = 0;
-    pdf_pages = new_pages;
-
-    // If requested, draw tractor edges or green background immediately on the new page so they appear under dots
-    if (draw_tractor_edges || draw_guide_strips) {
-        // the drawing routines append to the current page buffer
-        pdf_draw_tractor_edges_page();
+    // finish and write out the previous page
+    pdf_flush_page();
+    pdf_pages++;
+    pdf_page_open = 1;
+    if (pdf_occ_dirty) {
+        memset(pdf_occ, 0, ((size_t)pdf_occ_cols * pdf_occ_rows + 7) / 8);
+        pdf_occ_dirty = 0;
+    }
+    pdf_page_len = 0;
+    pdf_line_width = -1.0f;
+    pdf_stroke_pending = 0;
+    pdf_text_tc = 0.0f;
+    pdf_text_rise = 0.0f;
+    pdf_text_shade = -1;
+
+    int has_background = draw_tractor_edges || draw_guide_strips;
+
+    // Raster and SVG output: a blank page; the background is drawn into it
+    if (raster_format || svg_output) {
+        float media_width = draw_tractor_edges ? (page_width + (2.0f * TRACTOR_WIDTH_IN)) : page_width;
+        if (raster_format) raster_new_page(media_width * 72.0f, page_height * 72.0f);
+        else svg_new_page(media_width * 72.0f, page_height * 72.0f);
+        dl_clear(&dl_current, has_background ? DL_BG_INLINE : DL_BG_NONE);
+        return;
+    }
+
+    // In device units mode all page content is written in units of 1/pdf_units inch
+    if (pdf_units > 0) {
+        pdf_raw_appendf("%.9g 0 0 %.9g 0 0 cm\n", 72.0 / pdf_units, 72.0 / pdf_units);
+    }
+
+    // Stroked dots need round caps; set them once for the whole page
+    if (dot_style == DOT_STYLE_STROKE) {
+        pdf_raw_appendf("1 J\n");
     }
+
+    // Tractor edges or guide bands come first on the page, so they appear
+    // under dots; the background XObject for this geometry is written now
+    dl_clear(&dl_current, has_background ? pdf_background_variant() : DL_BG_NONE);
 }
 
 void pdf_ensure(size_t extra) {
-    if (pdf_pages == 0) pdf_new_page();
-    int idx = pdf_pages - 1;
-    if (pdf_contents[idx] == NULL) {
-        pdf_caps[idx] = 8192;
-        pdf_contents[idx] = (char*)malloc(pdf_caps[idx]);
-        pdf_lens[idx] = 0;
-    }
-    if (pdf_lens[idx] + extra + 1 > pdf_caps[idx]) {
-        while (pdf_lens[idx] + extra + 1 > pdf_caps[idx]) pdf_caps[idx] *= 2;
-        pdf_contents[idx] = (char*)realloc(pdf_contents[idx], pdf_caps[idx]);
+    if (!pdf_page_open) pdf_new_page();
+    if (pdf_page_len + extra + 1 > pdf_page_cap) {
+        if (pdf_page_cap == 0) pdf_page_cap = 8192;
+        while (pdf_page_len + extra + 1 > pdf_page_cap) pdf_page_cap *= 2;
+        pdf_page_data = (char*)realloc(pdf_page_data, pdf_page_cap);
     }
 }
 
+// Append formatted text to the current page without touching the open path
+void pdf_vappend(const char *fmt, va_list args) {
+    va_list args2;
+    va_copy(args2, args);
+    int needed = vsnprintf(NULL, 0, fmt, args2);
+    va_end(args2);
+    if (needed < 0) needed = 0;
+    pdf_ensure((size_t)needed);
+    vsnprintf(pdf_page_data + pdf_page_len, pdf_page_cap - pdf_page_len, fmt, args);
+    pdf_page_len += (size_t)needed;
+}
+
+void pdf_raw_appendf(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    pdf_vappend(fmt, args);
+    va_end(args);
+}
+
+// Append formatted text to the current page. Any pending stroked dots and
+// text runs are finished first so they keep their place in the painting order.
 void pdf_appendf(const char *fmt, ...) {
-    if (pdf_pages == 0) pdf_new_page();
-    int idx = pdf_pages - 1;
+    pdf_flush_pending();
     va_list args;
     va_start(args, fmt);
+    pdf_vappend(fmt, args);
+    va_end(args);
+}
+
+// Round to the nearest integer (halves away from zero)
+static long pdf_round(float v) {
+    return (long)(v < 0.0f ? v - 0.5f : v + 0.5f);
+}
+
+// --- Number output ---
+// Coordinates are formatted here instead of with vsnprintf: numbers are
+// rounded to three decimals and written straight into the page buffer with
+// trailing zeros dropped ("12.5", "-3", "0.25"). With pdf_units set, lengths
+// are converted to device units and written as integers.
+
+#define PDF_NUM_MAX 24                        // longest formatted number, with separator
+
+static const char pdf_digit_pairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// Write the decimal digits of u at p and return the new end
+static char *pdf_fmt_uint(char *p, unsigned long u) {
+    char tmp[20];
+    char *t = tmp + sizeof(tmp);
+    while (u >= 100) {
+        const char *d = pdf_digit_pairs + (u % 100) * 2;
+        u /= 100;
+        *--t = d[1];
+        *--t = d[0];
+    }
+    if (u >= 10) {
+        const char *d = pdf_digit_pairs + u * 2;
+        *--t = d[1];
+        *--t = d[0];
+    } else {
+        *--t = (char)('0' + u);
+    }
+    size_t n = (size_t)(tmp + sizeof(tmp) - t);
+    memcpy(p, t, n);
+    return p + n;
+}
+
+// Write v rounded to three decimals at p and return the new end
+static char *pdf_fmt_num(char *p, float v) {
+    double m = (double)v * 1000.0;
+    long milli = (long)(m < 0.0 ? m - 0.5 : m + 0.5);
+    if (milli < 0) {
+        *p++ = '-';
+        milli = -milli;
+    }
+    p = pdf_fmt_uint(p, (unsigned long)milli / 1000);
+    unsigned frac = (unsigned)((unsigned long)milli % 1000);
+    if (frac) {
+        *p++ = '.';
+        *p++ = (char)('0' + frac / 100);
+        frac %= 100;
+        if (frac) {
+            const char *d = pdf_digit_pairs + frac * 2;
+            *p++ = d[0];
+            if (d[1] != '0') *p++ = d[1];
+        }
+    }
+    return p;
+}
+
+// Round a length in points to the precision it is written with
+static float pdf_snap(float pt) {
+    if (pdf_units > 0) return (float)pdf_round(pt * pdf_unit_scale) / pdf_unit_scale;
+    return (float)pdf_round(pt * 1000.0f) / 1000.0f;
+}
+
+// Append prefix, the n lengths in v (points) separated by spaces, then suffix,
+// to the current page without touching the open path. Numbers are followed by
+// a space, so suffix is normally an operator ("m ", "l\n").
+void pdf_raw_append_nums(const char *prefix, const float *v, int n, const char *suffix) {
+    size_t plen = strlen(prefix);
+    size_t slen = strlen(suffix);
+    pdf_ensure(plen + (size_t)n * PDF_NUM_MAX + slen);
+    char *p = pdf_page_data + pdf_page_len;
+    memcpy(p, prefix, plen);
+    p += plen;
+    for (int i = 0; i < n; i++) {
+        if (pdf_units > 0) {
+            p = pdf_fmt_num(p, (float)pdf_round(v[i] * pdf_unit_scale));
+        } else {
+            p = pdf_fmt_num(p, v[i]);
+        }
+        *p++ = ' ';
+    }
+    memcpy(p, suffix, slen);
+    p += slen;
+    pdf_page_len = (size_t)(p - pdf_page_data);
+}
+
+// Growable byte buffer for content built outside the page streams
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} pdf_buf;
+
+void pdf_buf_vappendf(pdf_buf *b, const char *fmt, va_list args) {
     va_list args2;
     va_copy(args2, args);
     int needed = vsnprintf(NULL, 0, fmt, args2);
     va_end(args2);
     if (needed < 0) needed = 0;
-    pdf_ensure((size_t)needed);
-    vsnprintf(pdf_contents[idx] + pdf_lens[idx], pdf_caps[idx] - pdf_lens[idx], fmt, args);
-    pdf_lens[idx] += (size_t)needed;
+    if (b->len + (size_t)needed + 1 > b->cap) {
+        if (b->cap == 0) b->cap = 256;
+        while (b->len + (size_t)needed + 1 > b->cap) b->cap *= 2;
+        b->data = (char*)realloc(b->data, b->cap);
+    }
+    vsnprintf(b->data + b->len, b->cap - b->len, fmt, args);
+    b->len += (size_t)needed;
+}
+
+void pdf_buf_appendf(pdf_buf *b, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    pdf_buf_vappendf(b, fmt, args);
     va_end(args);
 }
 
+void pdf_buf_append(pdf_buf *b, const void *data, size_t len) {
+    if (b->len + len + 1 > b->cap) {
+        if (b->cap == 0) b->cap = 256;
+        while (b->len + len + 1 > b->cap) b->cap *= 2;
+        b->data = (char*)realloc(b->data, b->cap);
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+}
+
+void pdf_buf_free(pdf_buf *b) {
+    free(b->data);
+    b->data = NULL;
+    b->len = 0;
+    b->cap = 0;
+}
+
 // Load a TrueType font file
 int pdf_load_font(const char *font_file_path) {
+    // a batch of conversions loads the font once
+    if (font_data && font_path_used && strcmp(font_path_used, font_file_path) == 0) return 1;
+    free(font_data);
+    free(font_path_used);
+    font_data = NULL;
+    font_data_len = 0;
+    font_path_used = NULL;
     FILE *f = fopen(font_file_path, "rb");
     if (!f) {
         fprintf(stderr, "Warning: Could not open font file '%s', using built-in Courier\n", font_file_path);
@@ -127,32 +663,98 @@ int pdf_load_font(const char *font_file_path) {
     return 1;
 }
 
-void pdf_init() {
-    // free any existing pages
-    if (pdf_contents) {
-        for (int i = 0; i < pdf_pages; i++) {
-            free(pdf_contents[i]);
+static void pdf_t3_reset(void);
+
+// Reset the document state for output starting at offset pos. Everything
+// collected for an earlier document of the same process (shared content
+// streams, fonts, Type3 glyphs) is dropped; the loaded font file is kept.
+static void pdf_reset_document(long pos) {
+    pdf_out_pos = pos;
+    pdf_obj_count = 0;
+    pdf_lin_refs = 0;
+    pdf_pages = 0;
+    pdf_page_open = 0;
+    pdf_page_len = 0;
+    pdf_background_count = 0;
+    dot_xobject_obj = 0;
+    pdf_prev_xref = -1;
+    pdf_resources_obj = PDF_OBJ_RESOURCES;
+    pdf_replace_page = 0;
+    pdf_unit_scale = pdf_units > 0 ? (float)pdf_units / 72.0f : 1.0f;
+    if (pdf_contents_count) memset(pdf_contents, 0, pdf_contents_cap * sizeof(pdf_content_entry));
+    pdf_contents_count = 0;
+    if (pdf_occ) pdf_occ_dirty = 1;           // cleared with the first page
+    font_needed = 0;
+    memset(font_used, 0, sizeof(font_used));
+    pdf_vintage_palette = 0;
+    pdf_line_width = -1.0f;
+    pdf_stroke_pending = 0;
+    pdf_text_state = PDF_TEXT_NONE;
+    pdf_text_font = -1;
+    pdf_text_shade = -1;
+    pdf_t3_reset();
+}
+
+// Start a new document on out: write the header and open the first page
+void pdf_init(FILE *out) {
+    pdf_out = out;
+    if (pdf_linearize && !raster_format && !svg_output) {
+        // linearization needs the whole document: write it to a temporary
+        // file first and reorder it into out in pdf_finish
+        pdf_lin_out = out;
+        pdf_out = tmpfile();
+        if (!pdf_out) {
+            fprintf(stderr, "Warning: Could not create a temporary file, writing a non-linearized PDF\n");
+            pdf_out = out;
+            pdf_lin_out = NULL;
         }
-        free(pdf_contents);
-        free(pdf_lens);
-        free(pdf_caps);
     }
-    pdf_contents = NULL;
-    pdf_lens = NULL;
-    pdf_caps = NULL;
-    pdf_pages = 0;
+    pdf_reset_document(0);
+    if (raster_format || svg_output) {
+        // pages are written by raster.h or svg.h (raster_init or svg_init has been called)
+        pdf_new_page();
+        return;
+    }
+    // reserve the fixed object numbers
+    while (pdf_obj_count < PDF_OBJ_RESOURCES) pdf_alloc_obj();
+    pdf_out_printf("%%PDF-%s\n%%\xFF\xFF\xFF\xFF\n", pdf_object_streams ? "1.5" : "1.4");
+    fflush(pdf_out);
     // create first page
     pdf_new_page();
 }
 
-// Draw a filled circle centered at (x_in inches, y_in inches) with radius in points.
+// Continue a document written earlier with an incremental update. out is
+// positioned at its end (len bytes); size is its xref /Size, prev_xref the
+// offset of its last xref section and kids its nkids Page objects. The last
+// page is rewritten by the first page of this section, which is opened here
+// if open_page is set (otherwise by the first character drawn on it).
+void pdf_init_append(FILE *out, long len, int size, long prev_xref, const int *kids, int nkids, int open_page) {
+    pdf_out = out;
+    pdf_reset_document(len);
+    while (pdf_obj_count < size - 1) pdf_alloc_obj();
+    // the pages of this section get their own fonts and resources
+    pdf_resources_obj = pdf_alloc_obj();
+    pdf_prev_xref = prev_xref;
+    if (nkids > 0) {
+        pdf_page_objs = (int*)realloc(pdf_page_objs, sizeof(int) * nkids);
+        memcpy(pdf_page_objs, kids, sizeof(int) * nkids);
+        pdf_pages = nkids - 1;
+        pdf_replace_page = kids[nkids - 1];
+    }
+    if (open_page) pdf_new_page();
+}
+
+// Draw a filled circle centered at (cx, cy) points with radius r points.
 // We approximate circle with 4 cubic Bézier curves using kappa.
-void pdf_draw_dot_inch(float x_in, float y_in, float radius_pt, float x_misalign_in) {
-    // Convert to points (72 pt = 1 in). PDF origin is bottom-left.
-    float cx = x_in * 72.0f;
-    float cy = page_height * 72.0f - (y_in * 72.0f);
-    cx += x_misalign_in * 72.0f;  // Apply horizontal misalignment
-    float r = radius_pt;
+void pdf_draw_circle_path(float cx, float cy, float r) {
+    if (raster_format) {
+        raster_fill_circle(cx, cy, r, 0);
+        return;
+    }
+    if (svg_output) {
+        svg_fill_circle(cx, cy, r);
+        return;
+    }
     const float k = 0.552284749831f; // approximation constant
     float ox = r * k;
     // Points for four segments
@@ -169,18 +771,269 @@ void pdf_draw_dot_inch(float x_in, float y_in, float radius_pt, float x_misalign
     float x10 = cx + ox; float y10 = cy - r;
     float x11 = cx + r; float y11 = cy - ox;
     // Build path: move to x0,y0 then four 'c' operators
-    pdf_appendf("%.3f %.3f m\n", x0, y0);
-    pdf_appendf("%.3f %.3f %.3f %.3f %.3f %.3f c\n", x1, y1, x2, y2, x3, y3);
-    pdf_appendf("%.3f %.3f %.3f %.3f %.3f %.3f c\n", x4, y4, x5, y5, x6, y6);
-    pdf_appendf("%.3f %.3f %.3f %.3f %.3f %.3f c\n", x7, y7, x8, y8, x9, y9);
-    pdf_appendf("%.3f %.3f %.3f %.3f %.3f %.3f c\n", x10, y10, x11, y11, x0, y0);
-    pdf_appendf("f\n");
+    const float path[26] = {
+        x0, y0,
+        x1, y1, x2, y2, x3, y3,
+        x4, y4, x5, y5, x6, y6,
+        x7, y7, x8, y8, x9, y9,
+        x10, y10, x11, y11, x0, y0
+    };
+    pdf_flush_pending();
+    pdf_raw_append_nums("", path, 2, "m\n");
+    pdf_raw_append_nums("", path + 2, 6, "c\n");
+    pdf_raw_append_nums("", path + 8, 6, "c\n");
+    pdf_raw_append_nums("", path + 14, 6, "c\n");
+    pdf_raw_append_nums("", path + 20, 6, "c\nf\n");
+}
+
+// Draw a dot centered at (cx, cy) points as a zero-length subpath. The round
+// line cap (set once per page) turns it into a disc of diameter 2*r when the
+// path is stroked. Consecutive dots share one path and a single 'S'.
+void pdf_draw_dot_stroke(float cx, float cy, float r) {
+    float w = r * 2.0f;
+    pdf_flush_text();
+    if (w != pdf_line_width) {
+        // the line width applies when the path is painted, so stroke first
+        pdf_flush_stroke();
+        pdf_raw_append_nums("", &w, 1, "w\n");
+        pdf_line_width = w;
+    }
+    const float pt[2] = { cx, cy };
+    pdf_raw_append_nums("", pt, 2, "m ");
+    pdf_raw_append_nums("", pt, 2, "l\n");
+    if (++pdf_stroke_pending >= DOT_STROKE_BATCH) pdf_flush_stroke();
 }
 
-// Draw a character at the current position
-void pdf_draw_char(float x_in, float y_in, int font_id, char c) {
+// Draw a dot centered at (cx, cy) points by placing the shared unit-circle
+// Form XObject /D, scaled to radius r.
+void pdf_draw_dot_xobject(float cx, float cy, float r) {
+    if (!dot_xobject_obj) dot_xobject_obj = pdf_alloc_obj();
+    const float m[6] = { r, 0.0f, 0.0f, r, cx, cy };
+    pdf_flush_pending();
+    pdf_raw_append_nums("q ", m, 6, "cm /D Do Q\n");
+}
+
+// Index of the grid cell of size cell holding v (rounds down for negative v too)
+static int pdf_cell_index(float v, float cell) {
+    int i = (int)(v / cell);
+    return (v < 0.0f && (float)i * cell != v) ? i - 1 : i;
+}
+
+// Mark the grid cell holding (x_in, y_in) inches as inked. Returns 1 if it
+// already was, 0 if it was free or lies outside the page.
+int pdf_dot_occupied(float x_in, float y_in) {
+    float cell = dot_overprint_tolerance;
+    if (cell < PDF_OCC_MIN_CELL_IN) cell = PDF_OCC_MIN_CELL_IN;
+    int cols = (int)((page_width + 2.0f * TRACTOR_WIDTH_IN) / cell) + 1;
+    int rows = (int)(page_height / cell) + 1;
+    if (cols != pdf_occ_cols || rows != pdf_occ_rows || cell != pdf_occ_cell) {
+        // first use, or the page geometry changed
+        free(pdf_occ);
+        pdf_occ_cols = cols;
+        pdf_occ_rows = rows;
+        pdf_occ_cell = cell;
+        pdf_occ = (unsigned char*)calloc(((size_t)cols * rows + 7) / 8, 1);
+        pdf_occ_dirty = 0;
+    }
+    if (x_in < 0.0f || y_in < 0.0f) return 0;
+    int col = (int)(x_in / cell);
+    int row = (int)(y_in / cell);
+    if (col >= cols || row >= rows) return 0;
+    size_t bit = (size_t)row * cols + col;
+    unsigned char mask = (unsigned char)(1u << (bit & 7));
+    if (pdf_occ[bit >> 3] & mask) return 1;
+    pdf_occ[bit >> 3] |= mask;
+    pdf_occ_dirty = 1;
+    return 0;
+}
+
+// Draw a dot centered at (cx, cy) points with radius r points, using the
+// encoding selected by dot_style.
+void pdf_draw_dot_pt(float cx, float cy, float radius_pt) {
+    if (raster_format) {
+        raster_dot(cx, cy, radius_pt);
+    } else if (svg_output) {
+        svg_dot(cx, cy, radius_pt);
+    } else if (dot_style == DOT_STYLE_STROKE) {
+        pdf_draw_dot_stroke(cx, cy, radius_pt);
+    } else if (dot_style == DOT_STYLE_XOBJECT) {
+        pdf_draw_dot_xobject(cx, cy, radius_pt);
+    } else {
+        pdf_draw_circle_path(cx, cy, radius_pt);
+    }
+}
+
+// Print a dot of needle centered at (x_in inches, y_in inches) with radius
+// in points. With an overprint tolerance set, dots landing on a cell that is
+// already inked on this page are dropped.
+void pdf_draw_dot_inch(float x_in, float y_in, float radius_pt, float x_misalign_in, int needle) {
+    x_in += x_misalign_in;  // Apply horizontal misalignment
+    if (!pdf_page_open) pdf_new_page();
+    if (dot_overprint_tolerance > 0.0f && pdf_dot_occupied(x_in, y_in)) return;
+    // Convert to points (72 pt = 1 in). PDF origin is bottom-left.
+    dl_add_dot(&dl_current, x_in * 72.0f, page_height * 72.0f - (y_in * 72.0f), radius_pt, needle);
+}
+
+// --- Text runs ---
+// Glyphs are collected into one text object until something else is drawn.
+// Glyphs that continue the run exactly share a TJ string, other positions on
+// the same baseline get a TJ offset, and a new baseline starts a new line
+// with Td. Character spacing, rise and gray are only written when they change.
+
+#define PDF_TEXT_PEN_SLACK 10                 // pen drift (millipoints) tolerated before a TJ correction
+
+// Append prefix, v (not a length, written as is) and suffix to the current page
+static void pdf_raw_append_num(const char *prefix, float v, const char *suffix) {
+    size_t plen = strlen(prefix);
+    size_t slen = strlen(suffix);
+    pdf_ensure(plen + PDF_NUM_MAX + slen);
+    char *p = pdf_page_data + pdf_page_len;
+    memcpy(p, prefix, plen);
+    p = pdf_fmt_num(p + plen, v);
+    memcpy(p, suffix, slen);
+    pdf_page_len = (size_t)(p + slen - pdf_page_data);
+}
+
+// Close the TJ array of the current run, keeping the text object open
+static void pdf_text_close_string() {
+    if (pdf_text_state != PDF_TEXT_STRING) return;
+    pdf_raw_appendf(")] TJ\n");
+    pdf_text_state = PDF_TEXT_OPEN;
+}
+
+// Open a text object if needed and select font (Type3 variant or
+// PDF_TEXT_F1) at size with character spacing tc (points)
+static void pdf_text_select(int font, float size, float tc) {
+    if (pdf_text_state == PDF_TEXT_NONE) {
+        if (!pdf_page_open) pdf_new_page();
+        pdf_raw_appendf("BT\n");
+        pdf_text_state = PDF_TEXT_OPEN;
+        pdf_text_lx = 0.0f;
+        pdf_text_ly = 0.0f;
+        pdf_text_pen = 0;
+    }
+    if (pdf_text_font != font) {
+        pdf_text_close_string();
+        char sel[16];
+        if (font == PDF_TEXT_F1) snprintf(sel, sizeof(sel), "/F1 ");
+        else snprintf(sel, sizeof(sel), "/T%d ", font);
+        pdf_raw_append_nums(sel, &size, 1, "Tf\n");
+        pdf_text_font = font;
+        pdf_text_size = size;
+    }
+    // Tc is kept to three decimals even in device units: it adds up along the line
+    float tc_out = (float)pdf_round(tc * pdf_unit_scale * 1000.0f) / 1000.0f;
+    if (tc_out / pdf_unit_scale != pdf_text_tc) {
+        pdf_text_close_string();
+        pdf_raw_append_num("", tc_out, " Tc\n");
+        pdf_text_tc = tc_out / pdf_unit_scale;
+    }
+}
+
+// Set the text rise (points) of the following glyphs
+static void pdf_text_set_rise(float rise) {
+    rise = pdf_snap(rise);
+    if (rise == pdf_text_rise) return;
+    pdf_text_close_string();
+    pdf_raw_append_nums("", &rise, 1, "Ts\n");
+    pdf_text_rise = rise;
+}
+
+// Vintage palette entry closest to intensity v (1 = full ink)
+static int pdf_vintage_shade(float v) {
+    float gray = 1.0f - v;
+    if (gray < 0.0f) gray = 0.0f;
+    if (gray > PDF_VINTAGE_GRAY_MAX) gray = PDF_VINTAGE_GRAY_MAX;
+    return (int)pdf_round(gray * (PDF_VINTAGE_SHADES - 1) / PDF_VINTAGE_GRAY_MAX);
+}
+
+// Fill the following glyphs with vintage palette entry shade
+static void pdf_text_set_shade(int shade) {
+    if (shade == pdf_text_shade) return;
+    pdf_text_close_string();
+    if (pdf_text_shade < 0) pdf_raw_appendf("/VP cs ");
+    pdf_raw_appendf("%d sc\n", shade);
+    pdf_text_shade = shade;
+    pdf_vintage_palette = 1;
+}
+
+// Show code in the selected font with its origin at (x, y) points;
+// advance is its width plus character spacing in millipoints
+static void pdf_text_show(int code, float x, float y, long advance) {
+    long target = pdf_round((x - pdf_text_lx) * 1000.0f);
+    if (pdf_snap(y - pdf_text_ly) == 0.0f) {
+        // same baseline: adjust the pen if the glyph does not continue the run
+        // (small drift from rounded glyph widths is corrected once it adds up)
+        long adj = pdf_text_pen - target;
+        int move = adj > PDF_TEXT_PEN_SLACK || adj < -PDF_TEXT_PEN_SLACK;
+        if (pdf_text_state == PDF_TEXT_STRING) {
+            if (move) pdf_raw_append_num(") ", (float)adj / pdf_text_size, " (");
+        } else if (move) {
+            pdf_raw_append_num("[", (float)adj / pdf_text_size, " (");
+        } else {
+            pdf_raw_appendf("[(");
+        }
+        if (!move) target = pdf_text_pen;
+    } else {
+        pdf_text_close_string();
+        // Td operands are rounded to the output precision; track the rounded line start
+        const float d[2] = { pdf_snap(x - pdf_text_lx), pdf_snap(y - pdf_text_ly) };
+        pdf_raw_append_nums("", d, 2, "Td [(");
+        pdf_text_lx += d[0];
+        pdf_text_ly += d[1];
+        target = 0;
+    }
+    pdf_text_state = PDF_TEXT_STRING;
+    // Escape string delimiters and write non-printable codes in octal
+    if (code == '(' || code == ')' || code == '\\') {
+        pdf_raw_appendf("\\%c", code);
+    } else if (code < 32 || code > 126) {
+        pdf_raw_appendf("\\%03o", code);
+    } else {
+        pdf_raw_appendf("%c", code);
+    }
+    pdf_text_pen = target + advance;
+}
+
+// Show character c of the embedded font with its cell at (x, y) points and
+// the baseline lowered by drop. Consecutive characters advance by advance,
+// the printer's character pitch; the font's own glyphs are 600/1000 em wide
+// and the difference is set as character spacing.
+static void pdf_show_char(float x, float y, float drop, float advance, int shade, unsigned char c) {
+    // Use the embedded font at a fixed size (10pt for 10 CPI)
+    float font_size_pt = 12.0f;
+    float glyph_pt = font_size_pt * 0.6f;
+    if (raster_format || svg_output) {
+        // draw the glyph from the font's outlines in the palette's gray
+        if (c == ' ' || !font_data) return;
+        if (shade < 0) shade = 0;
+        unsigned char gray = (unsigned char)pdf_round(255.0f * shade * PDF_VINTAGE_GRAY_MAX / (PDF_VINTAGE_SHADES - 1));
+        if (raster_format) {
+            raster_draw_glyph((const unsigned char*)font_data, font_data_len, c, x, y - drop, font_size_pt, gray);
+        } else {
+            svg_draw_char((const unsigned char*)font_data, font_data_len, c, x, y - drop, font_size_pt, gray);
+        }
+        return;
+    }
     // Mark that fonts are needed for this PDF
     font_needed = 1;
+    font_used[c] = 1;
+    pdf_flush_stroke();
+    pdf_text_select(PDF_TEXT_F1, font_size_pt, advance - glyph_pt);
+    // A space leaves no ink, so it keeps whatever rise and shade are set
+    if (c != ' ') {
+        pdf_text_set_rise(-drop);
+        // If vintage emulation is enabled, set a gray shade based on intensity
+        if (shade != DL_SHADE_NONE) pdf_text_set_shade(shade);
+    }
+    pdf_text_show(c, x, y, pdf_round((glyph_pt + pdf_text_tc) * 1000.0f));
+}
+
+// Print character c of the embedded font with its cell at (x_in, y_in)
+// inches, the baseline lowered by drop_in and a pitch of advance_in
+void pdf_draw_char(float x_in, float y_in, float drop_in, float advance_in, int font_id, char c) {
+    (void)font_id;
+    if (!pdf_page_open) pdf_new_page();
     // If tractor edges are enabled, offset x position by the tractor width
     // so text remains within the printable area
     float x_offset = draw_tractor_edges ? TRACTOR_WIDTH_IN : 0.0f;
@@ -190,133 +1043,989 @@ void pdf_draw_char(float x_in, float y_in, int font_id, char c) {
     // For a 12pt font, we need about 12-14pt from the top edge
     float top_margin_pt = 11.0f;
     float cy = page_height * 72.0f - (y_in * 72.0f) - top_margin_pt;
-    // Use the embedded font at a fixed size (10pt for 10 CPI)
-    float font_size_pt = 12.0f;
-    // If vintage emulation is enabled, set a gray color based on intensity
-    if (vintage_enabled) {
-        float v = vintage_current_intensity;
-        if (v < 0.0f) v = 0.0f;
-        if (v > 1.0f) v = 1.0f;
-        float col = 1.0f - v; // 0=black, 1=white
-        pdf_appendf("%.3f %.3f %.3f rg\n", col, col, col);
-    }
-    // Escape special PDF characters that have meaning inside parentheses strings
-    if (c == '(' || c == ')' || c == '\\') {
-        pdf_appendf("BT /F1 %.1f Tf %.3f %.3f Td (\\%c) Tj ET\n", font_size_pt, cx, cy, c);
+    // The shade is that of the ribbon now; spaces are kept so text runs stay unbroken
+    int shade = vintage_enabled ? pdf_vintage_shade(vintage_current_intensity) : DL_SHADE_NONE;
+    dl_add_glyph(&dl_current, DL_FONT_TTF, (unsigned char)c, cx, cy, drop_in * 72.0f, advance_in * 72.0f, shade);
+}
+
+// --- Type3 dot fonts (Epson text mode) ---
+// Characters are drawn as glyphs of PDF Type3 fonts whose glyph procedures
+// hold the character's dots. Every combination of pitch and print modes
+// that changes a character's dot pattern gets its own font variant, keyed
+// by an opaque float tuple supplied by the caller. Glyph space is in
+// millipoints (FontMatrix 0.001, used at size 1), so glyph coordinates and
+// widths are integers.
+
+#define PDF_T3_KEY_LEN 8                      // floats identifying a font variant
+#define PDF_T3_MAX_DOTS 256                   // dots per glyph (9 columns x 9 needles x 3 strikes)
+
+typedef struct {
+    float key[PDF_T3_KEY_LEN];
+    char *proc[256];                          // glyph procedure per code (NULL = unused)
+    size_t proc_len[256];
+    int width[256];                           // advance width (millipoints)
+    int bbox[4];                              // union of glyph bounding boxes
+} pdf_t3_font;
+
+static pdf_t3_font *pdf_t3_fonts = NULL;
+static int pdf_t3_count = 0;
+
+// Find or create the font variant for key
+int pdf_t3_variant(const float *key) {
+    for (int i = 0; i < pdf_t3_count; i++) {
+        if (memcmp(pdf_t3_fonts[i].key, key, sizeof(pdf_t3_fonts[i].key)) == 0) return i;
+    }
+    pdf_t3_fonts = (pdf_t3_font*)realloc(pdf_t3_fonts, sizeof(pdf_t3_font) * (pdf_t3_count + 1));
+    pdf_t3_font *f = &pdf_t3_fonts[pdf_t3_count];
+    memset(f, 0, sizeof(*f));
+    memcpy(f->key, key, sizeof(f->key));
+    return pdf_t3_count++;
+}
+
+// Drop all font variants and their glyphs
+static void pdf_t3_reset() {
+    for (int v = 0; v < pdf_t3_count; v++) {
+        for (int c = 0; c < 256; c++) free(pdf_t3_fonts[v].proc[c]);
+    }
+    pdf_t3_count = 0;
+}
+
+int pdf_t3_has_glyph(int v, int code) {
+    return pdf_t3_fonts[v].proc[code & 0xFF] != NULL;
+}
+
+// Define glyph code of variant v from n dots given in points relative to the
+// glyph origin (y grows upwards), each of radius radius_pt.
+void pdf_t3_define_glyph(int v, int code, int n, const float *dx_pt, const float *dy_pt, float radius_pt, float advance_pt) {
+    pdf_t3_font *f = &pdf_t3_fonts[v];
+    code &= 0xFF;
+    if (f->proc[code]) return;
+    int r = (int)(radius_pt * 1000.0f + 0.5f);
+    int wx = (int)(advance_pt * 1000.0f + 0.5f);
+    int llx = 0, lly = 0, urx = 0, ury = 0;
+    // Drop overprinted dots within the glyph (same cells as pdf_dot_occupied)
+    float kx[PDF_T3_MAX_DOTS], ky[PDF_T3_MAX_DOTS];
+    if (dot_overprint_tolerance > 0.0f && n <= PDF_T3_MAX_DOTS) {
+        float cell = dot_overprint_tolerance * 72.0f;
+        if (cell < PDF_OCC_MIN_CELL_IN * 72.0f) cell = PDF_OCC_MIN_CELL_IN * 72.0f;
+        int kept = 0;
+        for (int i = 0; i < n; i++) {
+            int dup = 0;
+            for (int j = 0; j < kept && !dup; j++) {
+                dup = pdf_cell_index(dx_pt[i], cell) == pdf_cell_index(kx[j], cell) &&
+                      pdf_cell_index(dy_pt[i], cell) == pdf_cell_index(ky[j], cell);
+            }
+            if (!dup) {
+                kx[kept] = dx_pt[i];
+                ky[kept] = dy_pt[i];
+                kept++;
+            }
+        }
+        dx_pt = kx;
+        dy_pt = ky;
+        n = kept;
+    }
+    if (svg_output) svg_define_dot_glyph(v, code, n, dx_pt, dy_pt, radius_pt);
+    for (int i = 0; i < n; i++) {
+        int x = (int)pdf_round(dx_pt[i] * 1000.0f);
+        int y = (int)pdf_round(dy_pt[i] * 1000.0f);
+        if (i == 0 || x - r < llx) llx = x - r;
+        if (i == 0 || y - r < lly) lly = y - r;
+        if (i == 0 || x + r > urx) urx = x + r;
+        if (i == 0 || y + r > ury) ury = y + r;
+    }
+    // d1: uncolored glyph, so viewers can cache it and paint it with the current color
+    pdf_buf b = {0};
+    pdf_buf_appendf(&b, "%d 0 %d %d %d %d d1\n", wx, llx, lly, urx, ury);
+    if (n > 0 && dot_style != DOT_STYLE_PATH) {
+        pdf_buf_appendf(&b, "1 J %d w\n", r * 2);
+        for (int i = 0; i < n; i++) {
+            int x = (int)pdf_round(dx_pt[i] * 1000.0f);
+            int y = (int)pdf_round(dy_pt[i] * 1000.0f);
+            pdf_buf_appendf(&b, "%d %d m %d %d l\n", x, y, x, y);
+        }
+        pdf_buf_appendf(&b, "S\n");
+    } else if (n > 0) {
+        int k = (int)(r * 0.552284749831f + 0.5f);
+        for (int i = 0; i < n; i++) {
+            int x = (int)pdf_round(dx_pt[i] * 1000.0f);
+            int y = (int)pdf_round(dy_pt[i] * 1000.0f);
+            pdf_buf_appendf(&b, "%d %d m %d %d %d %d %d %d c %d %d %d %d %d %d c "
+                                "%d %d %d %d %d %d c %d %d %d %d %d %d c\n",
+                            x + r, y,
+                            x + r, y + k, x + k, y + r, x, y + r,
+                            x - k, y + r, x - r, y + k, x - r, y,
+                            x - r, y - k, x - k, y - r, x, y - r,
+                            x + k, y - r, x + r, y - k, x + r, y);
+        }
+        pdf_buf_appendf(&b, "f\n");
+    }
+    f->proc[code] = b.data;
+    f->proc_len[code] = b.len;
+    f->width[code] = wx;
+    if (n > 0) {
+        if (llx < f->bbox[0]) f->bbox[0] = llx;
+        if (lly < f->bbox[1]) f->bbox[1] = lly;
+        if (urx > f->bbox[2]) f->bbox[2] = urx;
+        if (ury > f->bbox[3]) f->bbox[3] = ury;
+    }
+}
+
+// Show glyph code of variant v with its origin at (x, y) points
+static void pdf_show_t3_glyph(int v, int code, float x, float y) {
+    if (svg_output) {
+        svg_use_glyph(v, code, x, y, 0);
+        return;
+    }
+    pdf_flush_stroke();
+    // size 1: one glyph unit per millipoint
+    pdf_text_select(v, 1.0f, 0.0f);
+    pdf_text_set_rise(0.0f);
+    pdf_text_show(code, x, y, pdf_t3_fonts[v].width[code]);
+}
+
+// Print glyph code of variant v with its origin at (x_in, y_in) inches
+void pdf_draw_t3_glyph(int v, int code, float x_in, float y_in) {
+    if (!pdf_page_open) pdf_new_page();
+    dl_add_glyph(&dl_current, v, code & 0xFF, x_in * 72.0f, page_height * 72.0f - (y_in * 72.0f), 0.0f, 0.0f, DL_SHADE_NONE);
+}
+
+// Draw the dots of d as stroked zero-length subpaths, exactly as
+// pdf_draw_dot_stroke would, with their positions formatted in blocks
+// straight from the display list grid
+static void pdf_stroke_dots(const dl_page *d) {
+    pdf_flush_text();
+    int i = 0;
+    while (i < d->dots) {
+        int k = d->dot_radius[i];
+        float w = d->radius[k] * 2.0f;
+        if (w != pdf_line_width) {
+            pdf_flush_stroke();
+            pdf_raw_append_nums("", &w, 1, "w\n");
+            pdf_line_width = w;
+        }
+        // the following dots of this width, up to the end of the path
+        int n = 1;
+        while (i + n < d->dots && d->dot_radius[i + n] == k && pdf_stroke_pending + n < DOT_STROKE_BATCH) n++;
+        pdf_ensure((size_t)n * DOTFMT_DOT_MAX);
+        char *end = dotfmt_stroke(pdf_page_data + pdf_page_len, d->dot_x + i, d->dot_y + i, n);
+        pdf_page_len = (size_t)(end - pdf_page_data);
+        pdf_stroke_pending += n;
+        if (pdf_stroke_pending >= DOT_STROKE_BATCH) pdf_flush_stroke();
+        i += n;
+    }
+}
+
+// Render display list d into the current page: the background, then the
+// dots, then the glyphs, each in printing order
+static void pdf_render_page(const dl_page *d) {
+    if (d->background >= 0) {
+        pdf_raw_appendf("/B%d Do\n", d->background);
+    } else if (d->background == DL_BG_INLINE) {
+        // the drawing routines append to the current page buffer
+        pdf_draw_tractor_edges_page();
+    }
+    if (dot_style == DOT_STYLE_STROKE && !raster_format && !svg_output && pdf_units == 0) {
+        pdf_stroke_dots(d);
     } else {
-        pdf_appendf("BT /F1 %.1f Tf %.3f %.3f Td (%c) Tj ET\n", font_size_pt, cx, cy, c);
+        for (int i = 0; i < d->dots; i++) {
+            pdf_draw_dot_pt(dl_dot_x(d, i), dl_dot_y(d, i), d->radius[d->dot_radius[i]]);
+        }
     }
-    // Reset fill color back to black for subsequent drawing (if vintage altered it)
-    if (vintage_enabled) {
-        pdf_appendf("0 0 0 rg\n");
+    for (int i = 0; i < d->glyphs; i++) {
+        if (d->glyph_font[i] == DL_FONT_TTF) {
+            pdf_show_char(d->glyph_x[i], d->glyph_y[i], d->glyph_drop[i], d->glyph_advance[i], d->glyph_shade[i], d->glyph_code[i]);
+        } else {
+            pdf_show_t3_glyph(d->glyph_font[i], d->glyph_code[i], d->glyph_x[i], d->glyph_y[i]);
+        }
     }
 }
 
-// Write the PDF file to the given FILE*
-void pdf_write(FILE *out) {
-    if (!out) return;
-    if (pdf_pages == 0) return;
-    
-    // Determine object count based on whether we need fonts
-    // Objects: 1 Catalog + 1 Pages + Font objects + 2 per page (Page obj + Content obj)
-    // If custom font: need Font dict (3), FontDescriptor (4), FontFile stream (5), then pages start at 6
-    // If builtin font: need Font dict (3), then pages start at 4
-    // If no font needed: pages start at 3
-    int font_objs = 0;
-    if (font_needed) {
-        font_objs = font_data ? 3 : 1; // 3 objects for TTF (dict, descriptor, stream), 1 for builtin
+// Start stream object id; the caller adds its own dictionary entries, each
+// followed by a space
+void pdf_begin_stream_obj(int id) {
+    pdf_begin_obj(id);
+    pdf_out_printf("<< ");
+}
+
+// Finish the stream object begun with pdf_begin_stream_obj with data,
+// Flate-compressed at level (-1 = not compressed)
+void pdf_end_stream_obj(const void *data, size_t len, int level) {
+    if (level >= 0) {
+        size_t zlen = 0;
+        unsigned char *z = deflate_zlib((const unsigned char*)data, len, level, &zlen);
+        pdf_out_printf("/Filter /FlateDecode /Length %zu >>\nstream\n", zlen);
+        pdf_out_write(z, zlen);
+        free(z);
+    } else {
+        pdf_out_printf("/Length %zu >>\nstream\n", len);
+        pdf_out_write(data, len);
     }
-    int first_page_obj = 3 + font_objs;
-    int totalObjs = 2 + font_objs + (2 * pdf_pages);
-    long *offsets = (long*)malloc(sizeof(long) * (totalObjs + 1));
-    memset(offsets, 0, sizeof(long) * (totalObjs + 1));
+    pdf_out_printf("\nendstream\nendobj\n");
+}
 
-    // Header
-    offsets[0] = ftell(out);
-    fprintf(out, "%%PDF-1.4\n%%\xFF\xFF\xFF\xFF\n");
+// Write stream object id holding data, Flate-compressed at level (-1 = not
+// compressed). extra is added to the stream dictionary ("" for none).
+void pdf_write_stream_obj_level(int id, const char *extra, const void *data, size_t len, int level) {
+    pdf_begin_stream_obj(id);
+    if (extra[0]) pdf_out_printf("%s ", extra);
+    pdf_end_stream_obj(data, len, level);
+}
 
-    // 1 0 obj Catalog
-    offsets[1] = ftell(out);
-    fprintf(out, "1 0 obj\n<< /Type /Catalog /Pages 2 0 R >>\nendobj\n");
+// Write stream object id holding data, Flate-compressed when enabled
+void pdf_write_stream_obj(int id, const char *extra, const void *data, size_t len) {
+    pdf_write_stream_obj_level(id, extra, data, len, pdf_compress_level);
+}
 
-    // 2 0 obj Pages
-    offsets[2] = ftell(out);
-    fprintf(out, "2 0 obj\n<< /Type /Pages /Kids [");
-    // list page object references
-    for (int i = 0; i < pdf_pages; i++) {
-        int pageObjId = first_page_obj + i * 2;
-        fprintf(out, "%d 0 R ", pageObjId);
+// --- Object streams (PDF 1.5) ---
+// Dictionary objects are written through pdf_begin_dict / pdf_obj_printf /
+// pdf_end_dict. Normally they go straight to the output; with
+// pdf_object_streams they are collected and written in batches as
+// compressed object streams, listed in the final xref stream.
+
+#define PDF_OBJSTM_MAX 200                    // objects per object stream
+#define PDF_OBJSTM_LEVEL 6                    // Flate level when -z is not given
+
+static pdf_buf pdf_objstm_index = {0};        // "id offset" pairs
+static pdf_buf pdf_objstm_body = {0};         // the objects themselves
+static int pdf_objstm_id = 0;                 // object number of the stream being collected (0 = none)
+static int pdf_objstm_n = 0;
+
+// Write the object stream collected so far
+void pdf_flush_objstm() {
+    if (pdf_objstm_n == 0) return;
+    char extra[64];
+    snprintf(extra, sizeof(extra), "/Type /ObjStm /N %d /First %zu", pdf_objstm_n, pdf_objstm_index.len);
+    pdf_buf_appendf(&pdf_objstm_index, "%.*s", (int)pdf_objstm_body.len, pdf_objstm_body.data);
+    pdf_write_stream_obj_level(pdf_objstm_id, extra, pdf_objstm_index.data, pdf_objstm_index.len,
+                               pdf_compress_level >= 0 ? pdf_compress_level : PDF_OBJSTM_LEVEL);
+    pdf_objstm_index.len = 0;
+    pdf_objstm_body.len = 0;
+    pdf_objstm_id = 0;
+    pdf_objstm_n = 0;
+}
+
+void pdf_begin_dict(int id) {
+    if (!pdf_object_streams) {
+        pdf_begin_obj(id);
+        return;
+    }
+    if (pdf_objstm_id == 0) pdf_objstm_id = pdf_alloc_obj();
+    // for objects in a stream the xref records the stream and the index within it
+    pdf_obj_stms[id] = pdf_objstm_id;
+    pdf_obj_offsets[id] = pdf_objstm_n;
+    pdf_buf_appendf(&pdf_objstm_index, "%d %zu ", id, pdf_objstm_body.len);
+}
+
+void pdf_obj_printf(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    if (pdf_object_streams) {
+        pdf_buf_vappendf(&pdf_objstm_body, fmt, args);
+    } else {
+        int n = vfprintf(pdf_out, fmt, args);
+        if (n > 0) pdf_out_pos += n;
+    }
+    va_end(args);
+}
+
+// Write an indirect reference to object id inside the dictionary object
+void pdf_obj_ref(int id) {
+    if (pdf_object_streams) {
+        pdf_obj_printf("%d 0 R", id);
+    } else {
+        pdf_out_ref(id);
     }
-    fprintf(out, "] /Count %d >>\nendobj\n", pdf_pages);
+}
+
+void pdf_end_dict() {
+    if (!pdf_object_streams) {
+        pdf_out_printf("\nendobj\n");
+        return;
+    }
+    pdf_buf_appendf(&pdf_objstm_body, "\n");
+    if (++pdf_objstm_n >= PDF_OBJSTM_MAX) pdf_flush_objstm();
+}
+
+// End of the run of objects starting at id that were written in this
+// section (those of an updated document have no offset)
+static int pdf_xref_run_end(int id) {
+    while (id <= pdf_obj_count && (pdf_obj_offsets[id] || pdf_obj_stms[id])) id++;
+    return id;
+}
+
+// Write the 7-byte xref stream entry of object i at e
+static void pdf_xref_stream_entry(unsigned char *e, int i) {
+    unsigned long field2 = i == 0 ? 0 : pdf_obj_stms[i] ? (unsigned long)pdf_obj_stms[i] : (unsigned long)pdf_obj_offsets[i];
+    unsigned field3 = i == 0 ? 65535 : pdf_obj_stms[i] ? (unsigned)pdf_obj_offsets[i] : 0;
+    e[0] = i == 0 ? 0 : pdf_obj_stms[i] ? 2 : 1;
+    e[1] = (unsigned char)(field2 >> 24);
+    e[2] = (unsigned char)(field2 >> 16);
+    e[3] = (unsigned char)(field2 >> 8);
+    e[4] = (unsigned char)field2;
+    e[5] = (unsigned char)(field3 >> 8);
+    e[6] = (unsigned char)field3;
+}
+
+// Write the cross-reference stream (PDF 1.5) that ends the file, with
+// entries of 1 byte type, 4 bytes offset or stream number, 2 bytes
+// generation or index
+void pdf_write_xref_stream() {
+    pdf_flush_objstm();
+    int xref_obj = pdf_alloc_obj();
+    long xref_pos = pdf_out_pos;
+    pdf_obj_offsets[xref_obj] = xref_pos;
+    pdf_xref_pos = xref_pos;
+    pdf_buf extra = {0};
+    pdf_buf_appendf(&extra, "/Type /XRef /Size %d /W [1 4 2] /Root %d 0 R", pdf_obj_count + 1, PDF_OBJ_CATALOG);
+    size_t len = 0;
+    unsigned char *x = (unsigned char*)malloc((size_t)(pdf_obj_count + 1) * 7);
+    if (pdf_prev_xref < 0) {
+        for (int i = 0; i <= pdf_obj_count; i++, len += 7) pdf_xref_stream_entry(x + len, i);
+    } else {
+        // incremental update: list the runs of objects written now in /Index
+        pdf_buf_appendf(&extra, " /Prev %ld /Index [", pdf_prev_xref);
+        for (int i = 1, end; i <= pdf_obj_count; i = end) {
+            end = pdf_xref_run_end(i);
+            if (end == i) {
+                end++;
+                continue;
+            }
+            pdf_buf_appendf(&extra, "%d %d ", i, end - i);
+            for (int j = i; j < end; j++, len += 7) pdf_xref_stream_entry(x + len, j);
+        }
+        pdf_buf_appendf(&extra, "]");
+    }
+    pdf_write_stream_obj_level(xref_obj, extra.data, x, len, pdf_compress_level >= 0 ? pdf_compress_level : PDF_OBJSTM_LEVEL);
+    pdf_buf_free(&extra);
+    free(x);
+    pdf_out_printf("startxref\n%ld\n%%%%EOF\n", xref_pos);
+}
+
+// --- Linearization ---
+// In linearized mode the document is first written normally to a temporary
+// file. pdf_write_linearized then reads it back and writes the final file in the
+// order of PDF 32000-1 Annex F:
+//
+//   header, linearization dictionary, first-page xref and trailer,
+//   Catalog, primary hint stream, first page section (page 1, its content
+//   and all shared resources: Resources, fonts, XObjects),
+//   remaining pages (page object, content), Pages tree,
+//   main xref and trailer
+//
+// Objects are renumbered so the first-page xref covers the highest
+// numbers. Every resource is reachable from page 1, so there is no
+// separate shared objects section; later pages reference the shared
+// resources in the first page section through the hint tables.
+
+typedef struct {
+    pdf_buf *b;
+    unsigned acc;
+    int nbits;
+} pdf_bits;
+
+// Append the low n bits of v, most significant first
+static void pdf_bits_put(pdf_bits *w, unsigned long v, int n) {
+    for (int i = n - 1; i >= 0; i--) {
+        w->acc = (w->acc << 1) | ((v >> i) & 1);
+        if (++w->nbits == 8) {
+            unsigned char c = (unsigned char)w->acc;
+            pdf_buf_append(w->b, &c, 1);
+            w->acc = 0;
+            w->nbits = 0;
+        }
+    }
+}
+
+// Pad to a byte boundary (every hint table row starts on one)
+static void pdf_bits_flush(pdf_bits *w) {
+    if (w->nbits) pdf_bits_put(w, 0, 8 - w->nbits);
+}
 
-    // Only write font objects if fonts are needed
+// Number of bits needed to represent v
+static int pdf_bits_needed(unsigned long v) {
+    int n = 0;
+    while (v) {
+        n++;
+        v >>= 1;
+    }
+    return n;
+}
+
+// Read len bytes at off in file f into buf (NUL-terminated). Returns 0 on
+// success.
+static int pdf_lin_read(pdf_buf *buf, FILE *f, long off, size_t len) {
+    if (buf->cap < len + 1) {
+        buf->cap = len + 1;
+        buf->data = (char*)realloc(buf->data, buf->cap);
+    }
+    buf->len = 0;
+    if (fseek(f, off, SEEK_SET) != 0 || fread(buf->data, 1, len, f) != len) return 1;
+    buf->data[len] = 0;
+    buf->len = len;
+    return 0;
+}
+
+// Read old object id (ending at end in the temporary file f) into buf and
+// put it in dst as new object map[id]: the references noted while it was
+// written, from pdf_lin_ref_pos[ref] on, get their new numbers. Returns 0
+// on success.
+static int pdf_lin_object(pdf_buf *dst, pdf_buf *buf, FILE *f, int id, long end, int ref, const int *map) {
+    long off = pdf_obj_offsets[id];
+    if (pdf_lin_read(buf, f, off, (size_t)(end - off))) return 1;
+    dst->len = 0;
+    pdf_buf_appendf(dst, "%d 0 obj\n", map[id]);
+    size_t start = (size_t)snprintf(NULL, 0, "%d 0 obj\n", id);
+    for (; ref < pdf_lin_refs && pdf_lin_ref_pos[ref] < end; ref++) {
+        size_t at = (size_t)(pdf_lin_ref_pos[ref] - off);
+        pdf_buf_append(dst, buf->data + start, at - start);
+        pdf_buf_appendf(dst, "%d", map[pdf_lin_ref_obj[ref]]);
+        start = at + (size_t)snprintf(NULL, 0, "%d", pdf_lin_ref_obj[ref]);
+    }
+    pdf_buf_append(dst, buf->data + start, buf->len - start);
+    return 0;
+}
+
+// Order of objects a and b in the temporary file
+static int pdf_lin_cmp_offset(const void *a, const void *b) {
+    long oa = pdf_obj_offsets[*(const int*)a], ob = pdf_obj_offsets[*(const int*)b];
+    return oa < ob ? -1 : oa > ob;
+}
+
+// Build the primary hint stream data (page offset and shared object hint
+// tables). order[] lists the new object numbers in file order, with
+// first_page_objs objects in the first page section starting at
+// order[first]; each later page has two objects (page, content).
+// Offsets are given as if the hint stream were absent, as the spec requires.
+static void pdf_lin_hints(pdf_buf *h, size_t *shared_off, const size_t *len_of, const int *order, int first,
+                          int first_page_objs, long first_page_pos, int npages) {
+    pdf_bits w = { h, 0, 0 };
+    int nshared = first_page_objs - 2;        // resources in the first page section
+    h->len = 0;
+    *shared_off = 0;
+    if (npages < 1) return;
+
+    // Per-page values
+    unsigned long *nobj = (unsigned long*)malloc(sizeof(unsigned long) * npages);
+    unsigned long *plen = (unsigned long*)malloc(sizeof(unsigned long) * npages);
+    unsigned long *coff = (unsigned long*)malloc(sizeof(unsigned long) * npages);
+    unsigned long *clen = (unsigned long*)malloc(sizeof(unsigned long) * npages);
+    for (int i = 0; i < npages; i++) {
+        if (i == 0) {
+            nobj[i] = (unsigned long)first_page_objs;
+            plen[i] = 0;
+            for (int k = 0; k < first_page_objs; k++) plen[i] += len_of[order[first + k]];
+            coff[i] = len_of[order[first]];
+            clen[i] = len_of[order[first + 1]];
+        } else {
+            int k = first + first_page_objs + (i - 1) * 2;
+            nobj[i] = 2;
+            plen[i] = len_of[order[k]] + len_of[order[k + 1]];
+            coff[i] = len_of[order[k]];
+            clen[i] = len_of[order[k + 1]];
+        }
+    }
+    unsigned long min_nobj = nobj[0], max_nobj = nobj[0], min_plen = plen[0], max_plen = plen[0];
+    unsigned long min_coff = coff[0], max_coff = coff[0], min_clen = clen[0], max_clen = clen[0];
+    for (int i = 1; i < npages; i++) {
+        if (nobj[i] < min_nobj) min_nobj = nobj[i];
+        if (nobj[i] > max_nobj) max_nobj = nobj[i];
+        if (plen[i] < min_plen) min_plen = plen[i];
+        if (plen[i] > max_plen) max_plen = plen[i];
+        if (coff[i] < min_coff) min_coff = coff[i];
+        if (coff[i] > max_coff) max_coff = coff[i];
+        if (clen[i] < min_clen) min_clen = clen[i];
+        if (clen[i] > max_clen) max_clen = clen[i];
+    }
+    // later pages reference every shared resource; their identifiers are
+    // their positions in the first page section (after page and content)
+    int refs = npages > 1 ? nshared : 0;
+    int nobj_bits = pdf_bits_needed(max_nobj - min_nobj);
+    int plen_bits = pdf_bits_needed(max_plen - min_plen);
+    int coff_bits = pdf_bits_needed(max_coff - min_coff);
+    int clen_bits = pdf_bits_needed(max_clen - min_clen);
+    int nref_bits = pdf_bits_needed((unsigned long)refs);
+    int id_bits = pdf_bits_needed(refs > 0 ? (unsigned long)(first_page_objs - 1) : 0);
+
+    // Page offset hint table header (Table F.3)
+    pdf_bits_put(&w, min_nobj, 32);
+    pdf_bits_put(&w, (unsigned long)first_page_pos, 32);
+    pdf_bits_put(&w, (unsigned long)nobj_bits, 16);
+    pdf_bits_put(&w, min_plen, 32);
+    pdf_bits_put(&w, (unsigned long)plen_bits, 16);
+    pdf_bits_put(&w, min_coff, 32);
+    pdf_bits_put(&w, (unsigned long)coff_bits, 16);
+    pdf_bits_put(&w, min_clen, 32);
+    pdf_bits_put(&w, (unsigned long)clen_bits, 16);
+    pdf_bits_put(&w, (unsigned long)nref_bits, 16);
+    pdf_bits_put(&w, (unsigned long)id_bits, 16);
+    pdf_bits_put(&w, 0, 16);                  // numerator bits: no fractional positions
+    pdf_bits_put(&w, 0, 16);                  // denominator
+
+    // Per-page entries (Table F.4), item by item
+    for (int i = 0; i < npages; i++) pdf_bits_put(&w, nobj[i] - min_nobj, nobj_bits);
+    pdf_bits_flush(&w);
+    for (int i = 0; i < npages; i++) pdf_bits_put(&w, plen[i] - min_plen, plen_bits);
+    pdf_bits_flush(&w);
+    for (int i = 0; i < npages; i++) pdf_bits_put(&w, i == 0 ? 0 : (unsigned long)refs, nref_bits);
+    pdf_bits_flush(&w);
+    for (int i = 1; i < npages; i++) {
+        for (int k = 0; k < refs; k++) pdf_bits_put(&w, (unsigned long)(2 + k), id_bits);
+    }
+    pdf_bits_flush(&w);
+    pdf_bits_flush(&w);                       // numerators (0 bits each)
+    for (int i = 0; i < npages; i++) pdf_bits_put(&w, coff[i] - min_coff, coff_bits);
+    pdf_bits_flush(&w);
+    for (int i = 0; i < npages; i++) pdf_bits_put(&w, clen[i] - min_clen, clen_bits);
+    pdf_bits_flush(&w);
+
+    // Shared object hint table (Tables F.5, F.6): one group per object of
+    // the first page section, no shared objects section
+    *shared_off = h->len;
+    unsigned long min_glen = len_of[order[first]], max_glen = min_glen;
+    for (int k = 1; k < first_page_objs; k++) {
+        unsigned long l = len_of[order[first + k]];
+        if (l < min_glen) min_glen = l;
+        if (l > max_glen) max_glen = l;
+    }
+    int glen_bits = pdf_bits_needed(max_glen - min_glen);
+    pdf_bits_put(&w, 0, 32);                  // first object in the shared objects section (none)
+    pdf_bits_put(&w, 0, 32);                  // its location
+    pdf_bits_put(&w, (unsigned long)first_page_objs, 32);
+    pdf_bits_put(&w, (unsigned long)first_page_objs, 32);
+    pdf_bits_put(&w, 0, 16);                  // objects per group - 1 needs no bits
+    pdf_bits_put(&w, min_glen, 32);
+    pdf_bits_put(&w, (unsigned long)glen_bits, 16);
+    for (int k = 0; k < first_page_objs; k++) pdf_bits_put(&w, len_of[order[first + k]] - min_glen, glen_bits);
+    pdf_bits_flush(&w);
+    for (int k = 0; k < first_page_objs; k++) pdf_bits_put(&w, 0, 1);   // no MD5 signatures
+    pdf_bits_flush(&w);
+
+    free(nobj);
+    free(plen);
+    free(coff);
+    free(clen);
+}
+
+// Reorder the finished document in pdf_out (a temporary file of length
+// pdf_out_pos) into a linearized file on pdf_lin_out. The objects are read
+// back one at a time, once to measure them renumbered and once to write
+// them, so memory stays bounded by the largest object.
+// Returns 0 on success, 1 on failure.
+int pdf_write_linearized() {
+    FILE *src = pdf_out;
+    pdf_out = pdf_lin_out;
+    int count = pdf_obj_count;
+    int npages = pdf_pages;
+
+    // Old object ranges: each object runs to the start of the next one in the file
+    int *by_offset = (int*)malloc(sizeof(int) * (count + 1));
+    for (int i = 0; i < count; i++) by_offset[i] = i + 1;
+    qsort(by_offset, (size_t)count, sizeof(int), pdf_lin_cmp_offset);
+    // and holds the references noted from its first one on
+    long *end = (long*)malloc(sizeof(long) * (count + 1));
+    int *first_ref = (int*)malloc(sizeof(int) * (count + 1));
+    for (int k = 0, r = 0; k < count; k++) {
+        int id = by_offset[k];
+        end[id] = k + 1 < count ? pdf_obj_offsets[by_offset[k + 1]] : pdf_xref_pos;
+        while (r < pdf_lin_refs && pdf_lin_ref_pos[r] < pdf_obj_offsets[id]) r++;
+        first_ref[id] = r;
+    }
+
+    // Classify from the objects recorded for each page: pages, their
+    // contents, and the resources shared by all pages
+    char *kind = (char*)calloc((size_t)count + 1, 1);   // 'p' page, 'c' content, 's' shared
+    for (int i = 0; i < npages; i++) {
+        kind[pdf_page_objs[i]] = 'p';
+        kind[pdf_page_contents[i]] = 'c';
+    }
+    for (int i = PDF_OBJ_RESOURCES; i <= count; i++) {
+        if (!kind[i]) kind[i] = 's';
+    }
+
+    // New numbers: remaining pages and the Pages tree first (main xref),
+    // then linearization dict, Catalog, hint stream and first page section
+    int *map = (int*)calloc((size_t)count + 1, sizeof(int));
+    int next = 1;
+    for (int i = 1; i < npages; i++) {
+        map[pdf_page_objs[i]] = next++;
+        map[pdf_page_contents[i]] = next++;
+    }
+    map[PDF_OBJ_PAGES] = next++;
+    int lin_obj = next++;                     // first object of the first-page xref
+    map[PDF_OBJ_CATALOG] = next++;
+    int hint_obj = next++;
+    map[pdf_page_objs[0]] = next++;
+    map[pdf_page_contents[0]] = next++;
+    // shared resources in their original (file) order
+    int ns = 0;
+    for (int k = 0; k < count; k++) {
+        if (kind[by_offset[k]] == 's') {
+            map[by_offset[k]] = next++;
+            ns++;
+        }
+    }
+    int total = next - 1;
+
+    // Renumbered object sizes, indexed by new number
+    int *old_of = (int*)calloc((size_t)total + 1, sizeof(int));
+    size_t *len_of = (size_t*)calloc((size_t)total + 1, sizeof(size_t));
+    pdf_buf obj = {0}, buf = {0};
+    int result = 0;
+    for (int i = 1; i <= count && !result; i++) {
+        old_of[map[i]] = i;
+        result = pdf_lin_object(&obj, &buf, src, i, end[i], first_ref[i], map);
+        len_of[map[i]] = obj.len;
+    }
+
+    // File order
+    int *order = (int*)malloc(sizeof(int) * (total + 1));
+    int n = 0;
+    order[n++] = lin_obj;
+    order[n++] = map[PDF_OBJ_CATALOG];
+    order[n++] = hint_obj;
+    int first = n;                            // first page section
+    int first_page_objs = 2 + ns;
+    for (int k = 0; k < first_page_objs; k++) order[n++] = map[pdf_page_objs[0]] + k;
+    for (int i = 1; i <= 2 * (npages - 1); i++) order[n++] = i;
+    order[n++] = map[PDF_OBJ_PAGES];
+
+    // Fixed-size pieces: header, linearization dictionary, first-page xref
+    size_t header_len = (size_t)pdf_obj_offsets[1];
+    for (int i = 2; i <= count; i++) {
+        if ((size_t)pdf_obj_offsets[i] < header_len) header_len = (size_t)pdf_obj_offsets[i];
+    }
+    char lin_fmt[] = "%d 0 obj\n<< /Linearized 1 /L %010ld /H [ %010ld %010ld ] /O %d /E %010ld /N %d /T %010ld >>\nendobj\n";
+    len_of[lin_obj] = (size_t)snprintf(NULL, 0, lin_fmt, lin_obj, 0L, 0L, 0L, map[pdf_page_objs[0]], 0L, npages, 0L);
+    int fp_count = total - lin_obj + 1;
+    char fp_trailer_fmt[] = "trailer\n<< /Size %d /Root %d 0 R /Prev %010ld >>\nstartxref\n0\n%%%%EOF\n";
+    size_t fp_xref_len = (size_t)snprintf(NULL, 0, "xref\n%d %d\n", lin_obj, fp_count) + (size_t)fp_count * 20 +
+                         (size_t)snprintf(NULL, 0, fp_trailer_fmt, total + 1, map[PDF_OBJ_CATALOG], 0L);
+
+    // Hint stream: its size does not depend on the offsets it holds
+    pdf_buf hint = {0};
+    size_t shared_off = 0;
+    pdf_lin_hints(&hint, &shared_off, len_of, order, first, first_page_objs, 0, npages);
+    char hint_head[96];
+    int hint_head_len = snprintf(hint_head, sizeof(hint_head), "%d 0 obj\n<< /S %zu /Length %zu >>\nstream\n", hint_obj, shared_off, hint.len);
+    const char *hint_tail = "\nendstream\nendobj\n";
+    len_of[hint_obj] = (size_t)hint_head_len + hint.len + strlen(hint_tail);
+
+    // Offsets
+    long *pos = (long*)calloc((size_t)total + 1, sizeof(long));
+    long p = (long)header_len;
+    pos[lin_obj] = p;
+    p += (long)len_of[lin_obj];
+    long fp_xref_pos = p;
+    p += (long)fp_xref_len;
+    for (int k = 1; k < n; k++) {
+        pos[order[k]] = p;
+        p += (long)len_of[order[k]];
+        if (k == first + first_page_objs - 1) pos[0] = p;   // end of the first page section
+    }
+    long end_first_page = pos[0];
+    long main_xref_pos = p;
+    char main_head[32];
+    int main_head_len = snprintf(main_head, sizeof(main_head), "xref\n0 %d\n", lin_obj);
+    long file_len = main_xref_pos + main_head_len + (long)lin_obj * 20 +
+                    snprintf(NULL, 0, "trailer\n<< /Size %d >>\nstartxref\n%ld\n%%%%EOF\n", total + 1, fp_xref_pos);
+
+    // Now the real hint tables (page 1 offset as if the hint stream were absent)
+    pdf_lin_hints(&hint, &shared_off, len_of, order, first, first_page_objs,
+                  pos[map[pdf_page_objs[0]]] - (long)len_of[hint_obj], npages);
+
+    // Write
+    pdf_out_pos = 0;
+    if (!result) result = pdf_lin_read(&buf, src, 0, header_len);
+    if (!result) {
+        pdf_out_write(buf.data, header_len);
+        pdf_out_printf(lin_fmt, lin_obj, file_len, pos[hint_obj], (long)len_of[hint_obj],
+                       map[pdf_page_objs[0]], end_first_page, npages, main_xref_pos + main_head_len - 1);
+        pdf_out_printf("xref\n%d %d\n", lin_obj, fp_count);
+        for (int i = lin_obj; i <= total; i++) pdf_out_printf("%010ld 00000 n \n", pos[i]);
+        pdf_out_printf(fp_trailer_fmt, total + 1, map[PDF_OBJ_CATALOG], main_xref_pos);
+        for (int k = 1; k < n && !result; k++) {
+            int id = order[k];
+            if (id == hint_obj) {
+                pdf_out_write(hint_head, (size_t)hint_head_len);
+                pdf_out_write(hint.data, hint.len);
+                pdf_out_printf("%s", hint_tail);
+            } else {
+                int i = old_of[id];
+                result = pdf_lin_object(&obj, &buf, src, i, end[i], first_ref[i], map);
+                if (!result) pdf_out_write(obj.data, obj.len);
+            }
+        }
+        pdf_out_write(main_head, (size_t)main_head_len);
+        pdf_out_printf("0000000000 65535 f \n");
+        for (int i = 1; i < lin_obj; i++) pdf_out_printf("%010ld 00000 n \n", pos[i]);
+        pdf_out_printf("trailer\n<< /Size %d >>\nstartxref\n%ld\n%%%%EOF\n", total + 1, fp_xref_pos);
+        if (!result && pdf_out_pos != file_len) {
+            fprintf(stderr, "Error: linearized layout mismatch (%ld != %ld bytes)\n", pdf_out_pos, file_len);
+            result = 1;
+        }
+    }
+
+    pdf_buf_free(&obj);
+    pdf_buf_free(&buf);
+    pdf_buf_free(&hint);
+    free(len_of);
+    free(old_of);
+    free(pos);
+    free(order);
+    free(map);
+    free(kind);
+    free(end);
+    free(first_ref);
+    free(by_offset);
+    fclose(src);
+    return result;
+}
+
+// Finish the document: write the last page, the shared objects (fonts, dot
+// XObject, Resources), the Pages tree, the Catalog and the xref.
+// Returns 0 on success, 1 if writing failed.
+int pdf_finish() {
+    if (!pdf_out) return 1;
+    pdf_flush_page();
+    if (raster_format) return raster_finish();
+    if (svg_output) return svg_finish();
+
+    // Font objects (TTF: dict, descriptor, stream; builtin: dict)
+    int font_obj = 0;
     if (font_needed) {
+        font_obj = pdf_alloc_obj();
         if (font_data) {
-            // 3 0 obj Font Dictionary (TrueType)
-            offsets[3] = ftell(out);
-            fprintf(out, "3 0 obj\n<< /Type /Font /Subtype /TrueType /BaseFont /CustomFont /FirstChar 32 /LastChar 126 /Widths [");
+            int font_desc_obj = pdf_alloc_obj();
+            int font_file_obj = pdf_alloc_obj();
+            // Embed only the glyphs that were drawn. A subset font gets a
+            // six-letter tag derived from the character set, e.g. /KQBFXA+CustomFont
+            size_t subset_len = 0;
+            unsigned char *subset = ttf_subset((const unsigned char*)font_data, font_data_len, font_used, &subset_len);
+            char font_name[32] = "CustomFont";
+            if (subset) {
+                unsigned long h = 5381;
+                for (int c = 0; c < 256; c++) h = h * 33 + (font_used[c] ? (unsigned long)c + 1 : 0);
+                for (int i = 0; i < 6; i++) {
+                    font_name[i] = (char)('A' + h % 26);
+                    h /= 26;
+                }
+                snprintf(font_name + 6, sizeof(font_name) - 6, "+CustomFont");
+            } else {
+                fprintf(stderr, "Warning: Could not subset font '%s', embedding it whole\n", font_path_used);
+            }
+            // Font Dictionary (TrueType)
+            pdf_begin_dict(font_obj);
+            pdf_obj_printf("<< /Type /Font /Subtype /TrueType /BaseFont /%s /FirstChar 32 /LastChar 126 /Widths [", font_name);
             // Simple uniform widths for monospace (600 units per character for typical monospace font at 1000 UPM)
             for (int i = 32; i <= 126; i++) {
-                fprintf(out, "600 ");
+                pdf_obj_printf("600 ");
             }
-            fprintf(out, "] /FontDescriptor 4 0 R /Encoding /WinAnsiEncoding >>\nendobj\n");
-            
-            // 4 0 obj FontDescriptor
-            offsets[4] = ftell(out);
-            fprintf(out, "4 0 obj\n<< /Type /FontDescriptor /FontName /CustomFont /Flags 32 /FontBBox [-100 -200 1000 900] /ItalicAngle 0 /Ascent 800 /Descent -200 /CapHeight 700 /StemV 80 /FontFile2 5 0 R >>\nendobj\n");
-            
-            // 5 0 obj FontFile2 (TrueType font stream)
-            offsets[5] = ftell(out);
-            fprintf(out, "5 0 obj\n<< /Length %zu /Length1 %zu >>\nstream\n", font_data_len, font_data_len);
-            fwrite(font_data, 1, font_data_len, out);
-            fprintf(out, "\nendstream\nendobj\n");
+            pdf_obj_printf("] /FontDescriptor ");
+            pdf_obj_ref(font_desc_obj);
+            pdf_obj_printf(" /Encoding /WinAnsiEncoding >>");
+            pdf_end_dict();
+
+            // FontDescriptor
+            pdf_begin_dict(font_desc_obj);
+            pdf_obj_printf("<< /Type /FontDescriptor /FontName /%s /Flags 32 /FontBBox [-100 -200 1000 900] /ItalicAngle 0 /Ascent 800 /Descent -200 /CapHeight 700 /StemV 80 /FontFile2 ", font_name);
+            pdf_obj_ref(font_file_obj);
+            pdf_obj_printf(" >>");
+            pdf_end_dict();
+
+            // FontFile2 (TrueType font stream)
+            const void *file = subset ? (const void*)subset : (const void*)font_data;
+            size_t file_len = subset ? subset_len : font_data_len;
+            char extra[64];
+            snprintf(extra, sizeof(extra), "/Length1 %zu", file_len);
+            pdf_write_stream_obj(font_file_obj, extra, file, file_len);
+            free(subset);
         } else {
-            // 3 0 obj Font (Courier builtin)
-            offsets[3] = ftell(out);
-            fprintf(out, "3 0 obj\n<< /Type /Font /Subtype /Type1 /BaseFont /Courier >>\nendobj\n");
+            // Font (Courier builtin)
+            pdf_begin_dict(font_obj);
+            pdf_obj_printf("<< /Type /Font /Subtype /Type1 /BaseFont /Courier >>");
+            pdf_end_dict();
         }
     }
 
-    // Write each Page object
-    for (int i = 0; i < pdf_pages; i++) {
-        int pageObjId = first_page_obj + i * 2;
-        int contentObjId = first_page_obj + i * 2 + 1;
-        offsets[pageObjId] = ftell(out);
-        // Page width should be page_width (printable) or page_width+2*tractor when edges enabled
-        float media_width = draw_tractor_edges ? (page_width + (2.0f * TRACTOR_WIDTH_IN)) : page_width;
-        float w_pt = media_width * 72.0f;
-        float h_pt = page_height * 72.0f; // always 11 inches tall
-        // Only include font resources if fonts are needed
-        if (font_needed) {
-            fprintf(out, "%d 0 obj\n<< /Type /Page /Parent 2 0 R /MediaBox [0 0 %.3f %.3f] /Contents %d 0 R /Resources << /Font << /F1 3 0 R >> >> >>\nendobj\n", pageObjId, w_pt, h_pt, contentObjId);
-        } else {
-            fprintf(out, "%d 0 obj\n<< /Type /Page /Parent 2 0 R /MediaBox [0 0 %.3f %.3f] /Contents %d 0 R /Resources << >> >>\nendobj\n", pageObjId, w_pt, h_pt, contentObjId);
+    // Dot Form XObject: a filled unit circle, scaled and placed by 'cm' at each use
+    int dot_obj = dot_xobject_obj;
+    if (dot_obj) {
+        const char *dot = "1 0 m 1 0.5523 0.5523 1 0 1 c -0.5523 1 -1 0.5523 -1 0 c "
+                          "-1 -0.5523 -0.5523 -1 0 -1 c 0.5523 -1 1 -0.5523 1 0 c f";
+        pdf_write_stream_obj(dot_obj, "/Type /XObject /Subtype /Form /BBox [-1 -1 1 1]", dot, strlen(dot));
+    }
+
+    // Type3 fonts: one shared ToUnicode CMap, then per variant the font
+    // dictionary followed by one CharProc stream per used glyph
+    int *t3_font_obj = NULL;
+    if (pdf_t3_count > 0) {
+        // ToUnicode: ASCII maps to itself, italic variants (code + 128) to their upright character
+        const char *cmap = "/CIDInit /ProcSet findresource begin\n12 dict begin\nbegincmap\n"
+                           "/CIDSystemInfo << /Registry (Adobe) /Ordering (UCS) /Supplement 0 >> def\n"
+                           "/CMapName /Adobe-Identity-UCS def\n/CMapType 2 def\n"
+                           "1 begincodespacerange\n<00> <FF>\nendcodespacerange\n"
+                           "2 beginbfrange\n<20> <7E> <0020>\n<A0> <FE> <0020>\nendbfrange\n"
+                           "endcmap\nCMapName currentdict /CMap defineresource pop\nend\nend";
+        int t3_tounicode_obj = pdf_alloc_obj();
+        pdf_write_stream_obj(t3_tounicode_obj, "", cmap, strlen(cmap));
+        t3_font_obj = (int*)malloc(sizeof(int) * pdf_t3_count);
+        for (int v = 0; v < pdf_t3_count; v++) {
+            pdf_t3_font *f = &pdf_t3_fonts[v];
+            int first = -1, last = -1;
+            t3_font_obj[v] = pdf_alloc_obj();
+            int first_proc_obj = pdf_obj_count + 1;
+            for (int c = 0; c < 256; c++) {
+                if (!f->proc[c]) continue;
+                if (first < 0) first = c;
+                last = c;
+                pdf_write_stream_obj(pdf_alloc_obj(), "", f->proc[c], f->proc_len[c]);
+            }
+            pdf_begin_dict(t3_font_obj[v]);
+            pdf_obj_printf("<< /Type /Font /Subtype /Type3 /FontBBox [%d %d %d %d] /FontMatrix [0.001 0 0 0.001 0 0] /CharProcs <<",
+                           f->bbox[0], f->bbox[1], f->bbox[2], f->bbox[3]);
+            int proc_obj = first_proc_obj;
+            for (int c = 0; c < 256; c++) {
+                if (f->proc[c]) {
+                    pdf_obj_printf(" /c%d ", c);
+                    pdf_obj_ref(proc_obj++);
+                }
+            }
+            pdf_obj_printf(" >> /Encoding << /Type /Encoding /Differences [");
+            for (int c = 0; c < 256; c++) {
+                if (f->proc[c]) pdf_obj_printf("%d /c%d ", c, c);
+            }
+            pdf_obj_printf("] >> /FirstChar %d /LastChar %d /Widths [", first, last);
+            for (int c = first; c <= last; c++) {
+                pdf_obj_printf("%d ", f->proc[c] ? f->width[c] : 0);
+            }
+            pdf_obj_printf("] /Resources << >> /ToUnicode ");
+            pdf_obj_ref(t3_tounicode_obj);
+            pdf_obj_printf(" >>");
+            pdf_end_dict();
         }
     }
 
-    // Write each Content object (stream)
-    for (int i = 0; i < pdf_pages; i++) {
-        int contentObjId = first_page_obj + i * 2 + 1;
-        offsets[contentObjId] = ftell(out);
-        fprintf(out, "%d 0 obj\n<< /Length %zu >>\nstream\n", contentObjId, pdf_lens[i]);
-        if (pdf_lens[i] > 0) {
-            fwrite(pdf_contents[i], 1, pdf_lens[i], out);
+    // Resources shared by all pages
+    pdf_begin_dict(pdf_resources_obj);
+    pdf_obj_printf("<< ");
+    if (font_obj || pdf_t3_count > 0) {
+        pdf_obj_printf("/Font << ");
+        if (font_obj) {
+            pdf_obj_printf("/F1 ");
+            pdf_obj_ref(font_obj);
+            pdf_obj_printf(" ");
         }
-        fprintf(out, "\nendstream\nendobj\n");
+        for (int v = 0; v < pdf_t3_count; v++) {
+            pdf_obj_printf("/T%d ", v);
+            pdf_obj_ref(t3_font_obj[v]);
+            pdf_obj_printf(" ");
+        }
+        pdf_obj_printf(">> ");
+    }
+    if (dot_obj || pdf_background_count > 0) {
+        pdf_obj_printf("/XObject << ");
+        if (dot_obj) {
+            pdf_obj_printf("/D ");
+            pdf_obj_ref(dot_obj);
+            pdf_obj_printf(" ");
+        }
+        for (int i = 0; i < pdf_background_count; i++) {
+            pdf_obj_printf("/B%d ", i);
+            pdf_obj_ref(pdf_backgrounds[i].obj);
+            pdf_obj_printf(" ");
+        }
+        pdf_obj_printf(">> ");
+    }
+    if (pdf_vintage_palette) {
+        pdf_obj_printf("/ColorSpace << /VP [/Indexed /DeviceGray %d <", PDF_VINTAGE_SHADES - 1);
+        for (int i = 0; i < PDF_VINTAGE_SHADES; i++) {
+            pdf_obj_printf("%02X", (int)pdf_round(255.0f * PDF_VINTAGE_GRAY_MAX * i / (PDF_VINTAGE_SHADES - 1)));
+        }
+        pdf_obj_printf(">] >> ");
+    }
+    pdf_obj_printf(">>");
+    pdf_end_dict();
+    free(t3_font_obj);
+
+    // Pages (an earlier last page that was not redrawn is kept as it is)
+    if (pdf_replace_page) {
+        pdf_page_objs[pdf_pages++] = pdf_replace_page;
+        pdf_replace_page = 0;
+    }
+    pdf_begin_dict(PDF_OBJ_PAGES);
+    pdf_obj_printf("<< /Type /Pages /Kids [");
+    // list page object references
+    for (int i = 0; i < pdf_pages; i++) {
+        pdf_obj_ref(pdf_page_objs[i]);
+        pdf_obj_printf(" ");
+    }
+    pdf_obj_printf("] /Count %d >>", pdf_pages);
+    pdf_end_dict();
+
+    // Catalog (unchanged by an incremental update)
+    if (pdf_prev_xref < 0) {
+        pdf_begin_dict(PDF_OBJ_CATALOG);
+        pdf_obj_printf("<< /Type /Catalog /Pages ");
+        pdf_obj_ref(PDF_OBJ_PAGES);
+        pdf_obj_printf(" >>");
+        pdf_end_dict();
+    }
+
+    if (pdf_object_streams) {
+        pdf_write_xref_stream();
+        fflush(pdf_out);
+        return ferror(pdf_out) ? 1 : 0;
     }
 
     // xref
-    long xref_pos = ftell(out);
-    fprintf(out, "xref\n0 %d\n0000000000 65535 f \n", totalObjs + 1);
-    for (int i = 1; i <= totalObjs; i++) {
-        // If offsets entry is zero (shouldn't), print zeros
-        fprintf(out, "%010ld 00000 n \n", offsets[i]);
+    long xref_pos = pdf_out_pos;
+    pdf_xref_pos = xref_pos;
+    if (pdf_prev_xref < 0) {
+        pdf_out_printf("xref\n0 %d\n0000000000 65535 f \n", pdf_obj_count + 1);
+        for (int i = 1; i <= pdf_obj_count; i++) {
+            // If offsets entry is zero (shouldn't), print zeros
+            pdf_out_printf("%010ld 00000 n \n", pdf_obj_offsets[i]);
+        }
+    } else {
+        // incremental update: one subsection per run of objects written now
+        pdf_out_printf("xref\n0 1\n0000000000 65535 f \n");
+        for (int i = 1, end; i <= pdf_obj_count; i = end) {
+            end = pdf_xref_run_end(i);
+            if (end == i) {
+                end++;
+                continue;
+            }
+            pdf_out_printf("%d %d\n", i, end - i);
+            for (int j = i; j < end; j++) pdf_out_printf("%010ld 00000 n \n", pdf_obj_offsets[j]);
+        }
     }
 
     // trailer
-    fprintf(out, "trailer\n<< /Size %d /Root 1 0 R >>\nstartxref\n%ld\n%%%%EOF\n", totalObjs + 1, xref_pos);
+    pdf_out_printf("trailer\n<< /Size %d /Root %d 0 R", pdf_obj_count + 1, PDF_OBJ_CATALOG);
+    if (pdf_prev_xref >= 0) pdf_out_printf(" /Prev %ld", pdf_prev_xref);
+    pdf_out_printf(" >>\nstartxref\n%ld\n%%%%EOF\n", xref_pos);
+    if (pdf_lin_out) {
+        int result = ferror(pdf_out) || pdf_write_linearized();
+        pdf_lin_out = NULL;
+        fflush(pdf_out);
+        return result || ferror(pdf_out) ? 1 : 0;
+    }
+    fflush(pdf_out);
+    return ferror(pdf_out) ? 1 : 0;
+}
 
-    free(offsets);
+// Fill rectangle r (x, y, width, height in points) with the current fill
+// color, which is rgb (raster output uses its luminance)
+static void pdf_fill_rect(const float r[4], const float rgb[3]) {
+    if (raster_format) {
+        float luma = 0.299f * rgb[0] + 0.587f * rgb[1] + 0.114f * rgb[2];
+        raster_fill_rect(r[0], r[1], r[2], r[3], (unsigned char)(luma * 255.0f + 0.5f));
+    } else if (svg_output) {
+        svg_fill_rect(r[0], r[1], r[2], r[3], rgb);
+    } else {
+        pdf_raw_append_nums("", r, 4, "re\nf\n");
+    }
 }
 
 void pdf_draw_tractor_edges_page() {
@@ -346,12 +2055,11 @@ void pdf_draw_tractor_edges_page() {
         float full_w_in = page_width; // width of printable area in inches
         float y = 0.0f;
         // choose color: blue overrides green
-        if (green_blue) {
-            // soft blue
-            pdf_appendf("0.85 0.85 1.0 rg\n");
-        } else {
-            // soft green
-            pdf_appendf("0.85 1 0.85 rg\n");
+        static const float blue[3] = { 0.85f, 0.85f, 1.0f };     // soft blue
+        static const float green[3] = { 0.85f, 1.0f, 0.85f };    // soft green
+        const float *band_rgb = green_blue ? blue : green;
+        if (!raster_format && !svg_output) {
+            pdf_appendf(green_blue ? "0.85 0.85 1.0 rg\n" : "0.85 1 0.85 rg\n");
         }
         while (y < page_height - 1e-6f) {
             // draw a band from y to y+band_h_in
@@ -363,16 +2071,18 @@ void pdf_draw_tractor_edges_page() {
                     float line_h_in = band_h_in / 10.0f; // thin line height
                     for (int line = 0; line < 5; line++) {
                         float line_y = y + line * 2.0f * line_h_in;
-                        pdf_appendf("%.3f %.3f %.3f %.3f re\nf\n", x_offset_in * 72.0f, line_y * 72.0f, full_w_in * 72.0f, line_h_in * 72.0f);
+                        const float r[4] = { x_offset_in * 72.0f, line_y * 72.0f, full_w_in * 72.0f, line_h_in * 72.0f };
+                        pdf_fill_rect(r, band_rgb);
                     }
                 } else {
-                    pdf_appendf("%.3f %.3f %.3f %.3f re\nf\n", x_offset_in * 72.0f, y * 72.0f, full_w_in * 72.0f, h_band * 72.0f);
+                    const float r[4] = { x_offset_in * 72.0f, y * 72.0f, full_w_in * 72.0f, h_band * 72.0f };
+                    pdf_fill_rect(r, band_rgb);
                 }
                 // advance to the next band (band + white)
                 y += band_h_in * 2.0f;
         }
         // reset fill color to black
-        pdf_appendf("0 0 0 rg\n");
+        if (!raster_format && !svg_output) pdf_appendf("0 0 0 rg\n");
     }
 
     // Only draw microperforation vertical and tractor holes if tractor edges requested
@@ -381,8 +2091,10 @@ void pdf_draw_tractor_edges_page() {
         float micro_spacing_in = 0.03125f; // spacing between microperforation dots (1/32")
         float micro_radius_pt = 0.45f; // small dot radius in points (smaller)
         for (float y = 0.0f; y <= page_height + 0.0001f; y += micro_spacing_in) {
-            pdf_draw_dot_inch(seam_left_in, y, micro_radius_pt, 0.0f);
-            pdf_draw_dot_inch(seam_right_in, y, micro_radius_pt, 0.0f);
+            // not printed dots: bypass the overprint grid
+            float my = page_height * 72.0f - (y * 72.0f);
+            pdf_draw_dot_pt(seam_left_in * 72.0f, my, micro_radius_pt);
+            pdf_draw_dot_pt(seam_right_in * 72.0f, my, micro_radius_pt);
         }
 
         // Draw tractor holes along left and right edges (centered in the strip)
@@ -396,9 +2108,10 @@ void pdf_draw_tractor_edges_page() {
         float right_center_x = (seam_right_in + full_width) / 2.0f;
 
         for (float y = hole_margin; y <= page_height - hole_margin + 0.0001f; y += hole_spacing) {
-            // draw circles in inches -- pdf_draw_dot_inch expects inches for x,y and points for radius
-            pdf_draw_dot_inch(left_center_x, y, hole_radius, 0.0f);
-            pdf_draw_dot_inch(right_center_x, y, hole_radius, 0.0f);
+            // holes are few and large: always draw them as filled Bezier circles
+            float hy = page_height * 72.0f - (y * 72.0f);
+            pdf_draw_circle_path(left_center_x * 72.0f, hy, hole_radius);
+            pdf_draw_circle_path(right_center_x * 72.0f, hy, hole_radius);
         }
     }
 
@@ -4,6 +4,7 @@
 #include "pdf.h"
 #include <stdarg.h>
 #include <stdio.h>
+#include <sys/stat.h>
 
 // Global program settings
 #define DEBUG 0
@@ -18,6 +19,16 @@
 #define PAGE_XMARGIN 0.0    // in
 #define PAGE_YMARGIN 0.0    // in
 
+// Carriage positions and steps are integers in device units of 1/DEVICE_DPI
+// in, a common multiple of every step the printers take (1/60, 1/72, 1/120,
+// 1/144, 1/216 and 1/240 in), so they add up without rounding. Horizontal
+// units are nominal: the measured pitch of the printer is applied when a
+// position is converted to inches for output.
+#define DEVICE_DPI 4320
+#define EPSON_XSCALE (60.0f / 52.9f)   // a 1/60 in step moves 1/52.9 in (Epson-specific)
+#define HAMMER_XSCALE 1.133f           // a character is 1.133/cpi in wide (1403-specific)
+#define EPSON_COMPRESSED_XSTEP 21      // 17.14 cpi, the nearest to the nominal 17.16 (Epson-specific)
+
 // Number of columns per tab stop (default 8)
 #define TAB_STOPS 8
 
@@ -29,6 +40,8 @@
 // Printer dot
 #define DOT_RADIUS 0.5      // pt
 #define DOT_OPACITY 0.5     // 0.0 to 1.0
+#define DOT_XADJ 0.02f      // in (manual offset adjustment, Epson-specific)
+#define DOT_YADJ 0.05f      // in (manual offset adjustment, Epson-specific)
 
 // Printer flags
 extern int auto_cr;
@@ -50,8 +63,8 @@ extern float page_width;
 extern float page_height;
 extern int page_cpi;
 extern int page_lpi;
-extern float page_xmargin;
-extern float page_ymargin;
+extern int page_xmargin;     // device units
+extern int page_ymargin;     // device units
 
 // Wrapping behavior: when set, long lines wrap to next line; otherwise extra chars are discarded
 extern int wrap_enabled;
@@ -59,15 +72,13 @@ extern int wrap_enabled;
 // Line counter for automatic pagination
 extern int line_count;
 
-// Page cursor position
-extern float xpos;
-extern float ypos;
-extern float step60;         // in (Epson-specific)
-extern float step72;         // in (Epson-specific)
-extern float xstep;          // in
-extern float ystep;          // in
-extern float lstep;          // in (Epson-specific)
-extern float yoffset;        // in (subscript/superscript, Epson-specific)
+// Page cursor position (device units)
+extern int xpos;
+extern int ypos;
+extern int xstep;            // dot column pitch (Epson-specific)
+extern int ystep;            // needle pitch (Epson-specific)
+extern int lstep;            // line feed (Epson-specific)
+extern int yoffset;          // subscript/superscript (Epson-specific)
 
 // Forward declarations for tractor-edge option (defined later)
 extern int draw_tractor_edges;
@@ -82,6 +93,7 @@ extern int vintage_enabled;
 
 // Epson-specific
 extern float vintage_dot_misalignment[9];
+extern int type3_text;       // draw characters as Type3 font glyphs instead of dots
 
 // Vintage emulation
 void vintage_init(unsigned int seed);
@@ -117,6 +129,16 @@ const char *control_names[] = {
     "CAN", "EM", "SUB", "ESC", "FS", "GS", "RS", "US"
 };
 
+// Horizontal carriage position x in inches from the left margin of the paper
+static inline float printer_x_in(int x) {
+    return (float)x * (epson_initialized ? EPSON_XSCALE : HAMMER_XSCALE) / DEVICE_DPI;
+}
+
+// Vertical carriage position y in inches from the top of the page
+static inline float printer_y_in(int y) {
+    return (float)y / DEVICE_DPI;
+}
+
 // Print a message to stderr (debug/info only)
 static inline void print_stderr(const char *msg, ...) {
     if (!debug_enabled) return; // silent unless debug enabled
@@ -170,10 +192,11 @@ static inline void rotate_charset() {
     }
 }
 
-// Initialize the printer (Epson-specific)
+// Initialize the printer (Epson-specific). The charset is rotated once per
+// process, by the first conversion of a batch.
 static inline void epson_init() {
+    if (!epson_initialized) rotate_charset();
     epson_initialized = 1;
-    rotate_charset();
     print_stderr("Printer initialized.\n");
     printer_reset();
 }
@@ -190,8 +213,8 @@ static inline void printer_reset() {
     page_height = PAGE_HEIGHT;
     page_cpi = PAGE_CPI;
     page_lpi = PAGE_LPI;
-    page_xmargin = PAGE_XMARGIN;
-    page_ymargin = PAGE_YMARGIN;
+    page_xmargin = (int)(PAGE_XMARGIN * DEVICE_DPI);
+    page_ymargin = (int)(PAGE_YMARGIN * DEVICE_DPI);
 
     // Initialize Epson-specific fields if initialized
     if (epson_initialized) {
@@ -201,15 +224,13 @@ static inline void printer_reset() {
         mode_wide = 0;
         mode_wide1line = 0;
         //
-        step60 = 1.0 / 52.9;    // in (1 pc = 1/6 in)
-        step72 = 1.0 / 72.0;    // in (1 pt = 1/72 in)
-        xstep = 0.5;            // pc
-        ystep = 1.0;          // in
-        lstep = 1.0 / 6.0;    // in
+        xstep = DEVICE_DPI / 120;   // 10 cpi, 12 columns per character
+        ystep = DEVICE_DPI / 72;    // 1/72 in between needles
+        lstep = DEVICE_DPI / 6;     // 6 lpi
     } else {
         // 1403 hammer printer initialization
-        xstep = 0.5;          // pc
-        ystep = 1.0;          // in
+        xstep = DEVICE_DPI / 120;
+        ystep = DEVICE_DPI / 72;
     }
 
     //
@@ -217,28 +238,336 @@ static inline void printer_reset() {
     print_stderr("Printer reset.\n");
 }
 
-// Get a character from the input file
+// Return the carriage and all print modes to their power-on state, for
+// the next conversion of a batch
+static inline void printer_power_on() {
+    mode_bold = mode_italic = mode_doublestrike = mode_wide = mode_wide1line = 0;
+    mode_subscript = mode_superscript = mode_compressed = mode_elite = mode_underline = 0;
+    xstep = DEVICE_DPI / 120;
+    ystep = DEVICE_DPI / 72;
+    lstep = DEVICE_DPI / 6;
+    yoffset = 0;
+    vintage_current_intensity = 1.0f;
+    printer_reset();
+    xpos = page_xmargin;
+    ypos = page_ymargin;
+}
+
+// --- Batch mode ---
+// With -B every input file named on the command line is converted in turn
+// by one process, each to its name with the extension of the output format
+// (.pdf, .png, .pgm, .tif or .svg), in the directory given with -o if any.
+// With -M a manifest lists one conversion per line: the input, the output
+// and options that apply to that conversion only,
+//     jobs/a.prn out/a.pdf -v -e
+// Blank lines and lines starting with '#' are skipped, and names cannot
+// contain spaces. Every conversion starts from the command line options and
+// a printer just switched on; the rotated charset and the loaded font file
+// are kept from one conversion to the next.
+
+#define BATCH_MAX_ARGS 64
+
+// Output of input in batch mode: input with the extension of the output
+// format, in directory dir unless it is NULL (malloc'd)
+static char *batch_output_name(const char *input, const char *dir) {
+    static const char *const raster_ext[] = { ".pdf", ".pgm", ".png", ".tif" };
+    const char *ext = svg_output ? ".svg" : raster_ext[raster_format];
+    const char *base = strrchr(input, '/');
+    base = base ? base + 1 : input;
+    const char *dot = strrchr(base, '.');
+    size_t stem = dot && dot != base ? (size_t)(dot - input) : strlen(input);
+    char *out = (char*)malloc((dir ? strlen(dir) + 1 : 0) + strlen(input) + 5);
+    if (dir) {
+        sprintf(out, "%s/%.*s%s", dir, (int)(stem - (size_t)(base - input)), base, ext);
+    } else {
+        sprintf(out, "%.*s%s", (int)stem, input, ext);
+    }
+    return out;
+}
+
+// Whether output names the file input (opening it would truncate the input
+// before it is read, e.g. job.svg converted with -S next to itself)
+static int output_is_input(const char *input, const char *output) {
+    struct stat si, so;
+    if (strcmp(input, output) == 0) return 1;
+    return stat(input, &si) == 0 && stat(output, &so) == 0 && si.st_dev == so.st_dev && si.st_ino == so.st_ino;
+}
+
+// Run the conversions of a batch: the inputs argv[first..argc-1], or the
+// lines of manifest ("-" for standard input) if it is not NULL. options sets
+// up the options of one conversion from the command line and its own
+// arguments (job_argv[0] is a program name); convert runs it. Returns
+// nonzero if any conversion failed.
+static int batch_run(int argc, char *argv[], int first, const char *manifest, const char *dir,
+                     int (*options)(int argc, char *argv[], int job_argc, char *job_argv[]),
+                     int (*convert)(const char *input, const char *output)) {
+    int failed = 0;
+    if (!manifest) {
+        // the inputs, before option parsing reorders argv again
+        int n = argc - first;
+        char **inputs = (char**)malloc(sizeof(char*) * (n + 1));
+        memcpy(inputs, argv + first, sizeof(char*) * n);
+        for (int i = 0; i < n; i++) {
+            if (options(argc, argv, 0, NULL)) {
+                failed = 1;
+                break;
+            }
+            char *output = batch_output_name(inputs[i], dir);
+            if (convert(inputs[i], output)) {
+                fprintf(stderr, "Error converting %s\n", inputs[i]);
+                failed = 1;
+            }
+            free(output);
+        }
+        free(inputs);
+        return failed;
+    }
+    FILE *m = strcmp(manifest, "-") == 0 ? stdin : fopen(manifest, "r");
+    if (!m) {
+        fprintf(stderr, "Error opening manifest %s\n", manifest);
+        return 1;
+    }
+    char line[4096];
+    int line_no = 0;
+    while (fgets(line, sizeof(line), m)) {
+        line_no++;
+        char *job[BATCH_MAX_ARGS + 1];
+        int n = 0;
+        for (char *t = strtok(line, " \t\r\n"); t && n < BATCH_MAX_ARGS; t = strtok(NULL, " \t\r\n")) job[n++] = t;
+        job[n] = NULL;
+        if (n == 0 || job[0][0] == '#') continue;
+        // an option in place of a name would be written to as a file named "-e"
+        if (n < 2 || job[0][0] == '-' || job[1][0] == '-') {
+            fprintf(stderr, "%s:%d: expected an input and an output file before the options\n", manifest, line_no);
+            failed = 1;
+            continue;
+        }
+        // the options follow the output, which makes way for the program name
+        char *input = job[0];
+        char *output = job[1];
+        job[1] = argv[0];
+        if (options(argc, argv, n - 1, job + 1) || convert(input, output)) {
+            fprintf(stderr, "%s:%d: error converting %s\n", manifest, line_no, input);
+            failed = 1;
+        }
+    }
+    if (m != stdin) fclose(m);
+    return failed;
+}
+
+// --- Append mode ---
+// With --append a PDF written earlier is extended through an incremental
+// update instead of being rewritten. The sidecar file <output>.state records
+// where the PDF ends, its Page objects, and the printer state at the start
+// of its last page together with the input printed on that page. The next
+// run restores that state and replays that input, so the last page is
+// redrawn (replacing its Page object) and new lines continue on it.
+
+#define APPEND_STATE_MAGIC "printer-append 2"
+
+// Printer state kept in the sidecar
+static int *const append_ints[] = {
+    &mode_bold, &mode_italic, &mode_doublestrike, &mode_wide, &mode_wide1line, &mode_subscript,
+    &mode_superscript, &mode_compressed, &mode_elite, &mode_underline, &page_cpi, &page_lpi, &line_count,
+    &page_xmargin, &page_ymargin, &xpos, &ypos, &xstep, &ystep, &lstep, &yoffset
+};
+static float *const append_floats[] = {
+    &page_width, &page_height
+};
+#define APPEND_INTS (int)(sizeof(append_ints) / sizeof(append_ints[0]))
+#define APPEND_FLOATS (int)(sizeof(append_floats) / sizeof(append_floats[0]))
+
+typedef struct {
+    int i[APPEND_INTS];
+    float f[APPEND_FLOATS];
+} printer_state;
+
+static char *append_path = NULL;             // sidecar file (NULL = append mode off)
+static int append_resume = 0;                // the sidecar was read: continue its PDF
+static long append_pdf_len = 0;              // PDF length, xref /Size and last xref offset
+static int append_pdf_size = 0;
+static long append_pdf_xref = 0;
+static int append_pdf_objstm = 0;            // the PDF uses xref streams
+static int *append_kids = NULL;              // Page objects of the PDF
+static int append_nkids = 0;
+static printer_state append_page_state;      // printer state at the start of the last page
+static int append_page_opened = 1;           // the last page was opened by pdf_init, not by a character
+static unsigned char *append_input = NULL;   // input read since the last page started
+static size_t append_input_len = 0;
+static size_t append_input_cap = 0;
+static unsigned char *append_replay = NULL;  // input of the last page, read before the input file
+static size_t append_replay_len = 0;
+static size_t append_replay_pos = 0;
+static printer_state append_mark_state;      // state before the character being processed
+static int append_mark_pages = 0;
+static size_t append_mark_len = 0;
+
+static inline void printer_save_state(printer_state *st) {
+    for (int i = 0; i < APPEND_INTS; i++) st->i[i] = *append_ints[i];
+    for (int i = 0; i < APPEND_FLOATS; i++) st->f[i] = *append_floats[i];
+}
+
+static inline void printer_load_state(const printer_state *st) {
+    for (int i = 0; i < APPEND_INTS; i++) *append_ints[i] = st->i[i];
+    for (int i = 0; i < APPEND_FLOATS; i++) *append_floats[i] = st->f[i];
+}
+
+// Open outname for append mode: continue it if its sidecar exists, else
+// create it. Returns NULL (after printing an error) if it cannot be used.
+static FILE *append_open(const char *outname) {
+    append_path = (char*)malloc(strlen(outname) + 7);
+    sprintf(append_path, "%s.state", outname);
+    FILE *st = fopen(append_path, "rb");
+    if (!st) {
+        FILE *f = fopen(outname, "rb");
+        if (f) {
+            fclose(f);
+            fprintf(stderr, "Error: %s has no state file %s (remove it to start a new document)\n", outname, append_path);
+            return NULL;
+        }
+        return fopen(outname, "wb");
+    }
+    // header, PDF position, Page objects, printer state, then the raw input of the last page
+    char magic[32] = "";
+    int ok = fgets(magic, sizeof(magic), st) && strcmp(magic, APPEND_STATE_MAGIC "\n") == 0 &&
+             fscanf(st, "pdf %ld %d %ld %d\n", &append_pdf_len, &append_pdf_size, &append_pdf_xref, &append_pdf_objstm) == 4 &&
+             fscanf(st, "kids %d", &append_nkids) == 1 && append_nkids >= 0;
+    if (ok) {
+        append_kids = (int*)malloc(sizeof(int) * (append_nkids + 1));
+        for (int i = 0; ok && i < append_nkids; i++) ok = fscanf(st, " %d", &append_kids[i]) == 1;
+    }
+    ok = ok && fscanf(st, " page %d", &append_page_opened) == 1;
+    for (int i = 0; ok && i < APPEND_INTS; i++) ok = fscanf(st, " %d", &append_page_state.i[i]) == 1;
+    for (int i = 0; ok && i < APPEND_FLOATS; i++) ok = fscanf(st, " %f", &append_page_state.f[i]) == 1;
+    ok = ok && fscanf(st, " input %zu", &append_replay_len) == 1 && fgetc(st) == '\n';
+    if (ok) {
+        append_replay = (unsigned char*)malloc(append_replay_len + 1);
+        ok = fread(append_replay, 1, append_replay_len, st) == append_replay_len;
+    }
+    fclose(st);
+    if (!ok) {
+        fprintf(stderr, "Error: invalid state file %s\n", append_path);
+        return NULL;
+    }
+    FILE *fo = fopen(outname, "r+b");
+    if (!fo) {
+        fprintf(stderr, "Error opening file %s\n", outname);
+        return NULL;
+    }
+    fseek(fo, 0, SEEK_END);
+    if (ftell(fo) != append_pdf_len) {
+        fprintf(stderr, "Error: %s was changed after %s was written\n", outname, append_path);
+        fclose(fo);
+        return NULL;
+    }
+    append_resume = 1;
+    return fo;
+}
+
+// Start the PDF in append mode, once the printer is initialized: a new
+// document, or an update of the one described by the sidecar
+static void append_begin(FILE *fo) {
+    if (!append_resume) {
+        pdf_init(fo);
+        printer_save_state(&append_page_state);
+        append_page_opened = 1;
+        return;
+    }
+    printer_load_state(&append_page_state);
+    // the update must use the same kind of xref as the document
+    pdf_object_streams = append_pdf_objstm;
+    pdf_init_append(fo, append_pdf_len, append_pdf_size, append_pdf_xref, append_kids, append_nkids, append_page_opened);
+}
+
+// Remember the state before the next character is processed
+static inline void append_mark() {
+    if (!append_path) return;
+    printer_save_state(&append_mark_state);
+    append_mark_pages = pdf_pages;
+    append_mark_len = append_input_len;
+}
+
+// After a character: if it started a page, that page's input starts with it
+static inline void append_check() {
+    if (!append_path || pdf_pages == append_mark_pages) return;
+    append_page_state = append_mark_state;
+    append_page_opened = 0;
+    append_input_len -= append_mark_len;
+    memmove(append_input, append_input + append_mark_len, append_input_len);
+}
+
+// Write the sidecar for the PDF just finished (through a temporary file, so
+// an interrupted run leaves the previous one). Returns nonzero on error.
+static int append_save() {
+    char *tmp = (char*)malloc(strlen(append_path) + 5);
+    sprintf(tmp, "%s.tmp", append_path);
+    FILE *st = fopen(tmp, "wb");
+    if (!st) {
+        free(tmp);
+        return 1;
+    }
+    fprintf(st, "%s\npdf %ld %d %ld %d\nkids %d", APPEND_STATE_MAGIC, pdf_out_pos, pdf_obj_count + 1, pdf_xref_pos,
+            pdf_object_streams, pdf_pages);
+    for (int i = 0; i < pdf_pages; i++) fprintf(st, " %d", pdf_page_objs[i]);
+    fprintf(st, "\npage %d", append_page_opened);
+    for (int i = 0; i < APPEND_INTS; i++) fprintf(st, " %d", append_page_state.i[i]);
+    for (int i = 0; i < APPEND_FLOATS; i++) fprintf(st, " %a", (double)append_page_state.f[i]);
+    fprintf(st, "\ninput %zu\n", append_input_len);
+    fwrite(append_input, 1, append_input_len, st);
+    int result = ferror(st) | fclose(st);
+    if (!result) result = rename(tmp, append_path);
+    free(tmp);
+    return result ? 1 : 0;
+}
+
+// Get a character: the replayed input of the last page first, then the input file
 static inline int file_get_char(FILE *fi) {
-    return fgetc(fi);
+    int c = append_replay_pos < append_replay_len ? append_replay[append_replay_pos++] : fgetc(fi);
+    if (append_path && c != EOF) {
+        if (append_input_len == append_input_cap) {
+            append_input_cap = append_input_cap ? append_input_cap * 2 : 4096;
+            append_input = (unsigned char*)realloc(append_input, append_input_cap);
+        }
+        append_input[append_input_len++] = (unsigned char)c;
+    }
+    return c;
 }
 
+// Type3 glyph capture (Epson-specific): while set, epson_print_column records
+// dot positions relative to the glyph origin instead of drawing them
+static int epson_capture = 0;
+static int epson_capture_n = 0;
+static int epson_capture_x0, epson_capture_y0;      // cursor at the start of the character
+static int epson_capture_right;                     // rightmost column offset
+static float epson_capture_dx[PDF_T3_MAX_DOTS];     // pt, y grows upwards
+static float epson_capture_dy[PDF_T3_MAX_DOTS];
+
 // Print one column of a character (Epson-specific)
 static inline void epson_print_column(int c) {
     if (!epson_initialized) return;  // Only for Epson
-    float ys = ystep * step72;
-    float adj = step72 * 0.5;
+    float adj = 0.5f / 72.0f;
     // if tractor edges are present, printable area is offset from left by tractor strip width
     float x_offset_in = draw_tractor_edges ? TRACTOR_WIDTH_IN : 0.0f;
     // Printable area bounds (in inches)
     float printable_left = x_offset_in;
     float printable_right = x_offset_in + page_width;
     // Add a small offset adjustment
-    float manual_xadj = 0.02f;
-    float manual_yadj = 0.05f;
+    float manual_xadj = DOT_XADJ;
+    float manual_yadj = DOT_YADJ;
 
     for (int i = 0; i < 9; i++) {
         if (c & (1 << i)) {
-            float x_in = x_offset_in + xpos + adj;
+            if (epson_capture) {
+                int dx = xpos - epson_capture_x0;
+                if (dx > epson_capture_right) epson_capture_right = dx;
+                if (epson_capture_n < PDF_T3_MAX_DOTS) {
+                    epson_capture_dx[epson_capture_n] = (printer_x_in(dx) + (vintage_enabled ? vintage_dot_misalignment[i] : 0.0f)) * 72.0f;
+                    epson_capture_dy[epson_capture_n] = -printer_y_in(ypos - epson_capture_y0 + i * ystep) * 72.0f;
+                    epson_capture_n++;
+                }
+                continue;
+            }
+            float x_in = x_offset_in + printer_x_in(xpos) + adj;
             // Skip dots that would fall inside the tractor edges or outside the printable area
             if (draw_tractor_edges) {
                 if (x_in < printable_left - 1e-6f || x_in > printable_right + 1e-6f) {
@@ -246,69 +575,113 @@ static inline void epson_print_column(int c) {
                 }
             }
             // Draw a small filled circle for each dot in the PDF content stream
-            pdf_draw_dot_inch(x_in + manual_xadj, ypos + yoffset + adj + (i * ys) + manual_yadj, DOT_RADIUS, vintage_enabled ? vintage_dot_misalignment[i] : 0.0f);
+            pdf_draw_dot_inch(x_in + manual_xadj, printer_y_in(ypos + yoffset + i * ystep) + adj + manual_yadj, DOT_RADIUS, vintage_enabled ? vintage_dot_misalignment[i] : 0.0f, i);
         }
     }
 }
 
+// Strike the dot columns of one character (Epson-specific)
+static inline void epson_strike_char(int c) {
+    int index = c * 9;
+    int lc = 0;
+    int xs = xstep; // one dot column (1/120 in at 10 cpi)
+    int xds = xs * 2;
+    int yhs = ystep / 2;
+    for (int i = 0; i < 9; i++) {
+        c = charset[index];
+        epson_print_column(c | mode_underline);
+
+        if (mode_doublestrike)
+            ypos += yhs;
+        if (mode_bold)
+            xpos += xs;
+        if(mode_bold || mode_doublestrike) {
+            epson_print_column(c | mode_underline);
+        }
+        if (mode_bold)
+            xpos -= xs;
+        if (mode_doublestrike)
+            ypos -= yhs;
+        if(mode_wide) {
+            xpos += xds;
+            epson_print_column(c | mode_underline);
+            xpos -= xs;
+        }
+        index++;
+        xpos += xs;
+        lc = c;
+    }
+    for (int i = 0; i <= mode_wide; i++) {
+        xpos += xs;
+        xpos += xs;
+        xpos += xs;
+    }
+}
+
+// Print one character as a Type3 glyph (Epson-specific). The character is
+// struck in capture mode, which advances the cursor exactly like printing
+// dots and yields the glyph's dot pattern. Characters that would be clipped
+// by the tractor edges fall back to dots.
+static inline void epson_print_glyph(int c) {
+    float key[PDF_T3_KEY_LEN] = {
+        (float)xstep, (float)ystep,
+        (float)mode_bold, (float)mode_doublestrike, (float)mode_wide, (float)mode_underline,
+        0.0f, 0.0f
+    };
+    int x0 = xpos;
+    int y0 = ypos;
+    epson_capture = 1;
+    epson_capture_n = 0;
+    epson_capture_x0 = x0;
+    epson_capture_y0 = y0;
+    epson_capture_right = 0;
+    epson_strike_char(c);
+    epson_capture = 0;
+
+    float adj = 0.5f / 72.0f;
+    float x_offset_in = draw_tractor_edges ? TRACTOR_WIDTH_IN : 0.0f;
+    if (draw_tractor_edges && printer_x_in(x0 + epson_capture_right) + adj > page_width + 1e-6f) {
+        int x1 = xpos;
+        xpos = x0;
+        ypos = y0;
+        epson_strike_char(c);
+        xpos = x1;
+        return;
+    }
+    int v = pdf_t3_variant(key);
+    if (!pdf_t3_has_glyph(v, c)) {
+        pdf_t3_define_glyph(v, c, epson_capture_n, epson_capture_dx, epson_capture_dy, DOT_RADIUS, printer_x_in(xpos - x0) * 72.0f);
+    }
+    pdf_draw_t3_glyph(v, c, x_offset_in + printer_x_in(x0) + adj + DOT_XADJ, printer_y_in(y0 + yoffset) + adj + DOT_YADJ);
+}
+
 // Print one character
 static inline void printer_print_char(int c) {
     if (epson_initialized) {
         // Epson printer implementation
         if (mode_italic)
             c += 128;
-        int index = c * 9;
-        int lc = 0;
-        float xs = xstep * step60; // xs is in inches per dot column (1/120 in at 10 cpi)
-        float xhs = xs / 2;
-        float xds = xs * 2;
-        float ys = ystep * step72;
-        float yhs = ys / 2;
-        for (int i = 0; i < 9; i++) {
-            c = charset[index];
-            epson_print_column(c | mode_underline);
-
-            if (mode_doublestrike)
-                ypos += yhs;
-            if (mode_bold)
-                xpos += xs;
-            if(mode_bold || mode_doublestrike) {
-                epson_print_column(c | mode_underline);
-            }
-            if (mode_bold)
-                xpos -= xs;
-            if (mode_doublestrike)
-                ypos -= yhs;
-            if(mode_wide) {
-                xpos += xds;
-                epson_print_column(c | mode_underline);
-                xpos -= xs;
-            }
-            index++;
-            xpos += xs;
-            lc = c;
-        }
-        for (int i = 0; i <= mode_wide; i++) {
-            xpos += xs;
-            xpos += xs;
-            xpos += xs;
+        if (type3_text && c < 256) {
+            epson_print_glyph(c);
+        } else {
+            epson_strike_char(c);
         }
     } else {
         // 1403 hammer printer implementation
         // Determine font based on modes
         int font_id = 1; // Courier
         // Determine character width (account for wide modes)
-        float char_width = 1.133f / page_cpi; // inches per character based on page_cpi
+        int char_width = DEVICE_DPI / page_cpi;
 
         // If printing this character would go past the printable right edge, wrap to next line
-        float right_edge = page_xmargin + page_width;
-        if (xpos + char_width > right_edge - 1e-6f) {
+        float right_edge = printer_x_in(page_xmargin) + page_width;
+        if (printer_x_in(xpos + char_width) > right_edge - 1e-6f) {
             if (wrap_enabled) {
                 // advance to next line (like LF)
-                ypos += 1.0f / page_lpi;
+                ypos += DEVICE_DPI / page_lpi;
                 xpos = page_xmargin;
                 line_count++;
-                if (ypos >= page_height || line_count >= PAGE_LINES) {
+                if (ypos >= (int)(page_height * DEVICE_DPI) || line_count >= PAGE_LINES) {
                     pdf_new_page();
                     ypos = page_ymargin;
                     xpos = page_xmargin;
@@ -321,11 +694,11 @@ static inline void printer_print_char(int c) {
         }
 
         // Determine vintage adjustments if enabled
-        float draw_x = xpos;
-        float draw_y = ypos;
+        float draw_x = printer_x_in(xpos);
+        float draw_drop = 0.0f;
         if (vintage_enabled) {
             // compute column index (0-based)
-            int col = (int)((xpos - page_xmargin) / char_width + 0.001f);
+            int col = (xpos - page_xmargin) / char_width;
             if (col < 0) col = 0;
             if (vintage_cols > 0 && col >= vintage_cols) col = vintage_cols - 1;
             // set current intensity for pdf drawing
@@ -337,19 +710,20 @@ static inline void printer_print_char(int c) {
             // per-character deterministic misalignment (in inches)
             if (c >= 0 && c < 127) {
                 draw_x += vintage_char_xoff[c];
-                draw_y += vintage_char_yoff[c];
+                draw_drop = vintage_char_yoff[c];
             }
         }
 
-        // Draw the character (with any vintage adjustments applied)
-        pdf_draw_char(draw_x, draw_y, font_id, (char)c);
+        // Draw the character (with any vintage adjustments applied); characters
+        // of a line are collected into one text run
+        pdf_draw_char(draw_x, printer_y_in(ypos), draw_drop, printer_x_in(char_width), font_id, (char)c);
         // Advance cursor
         xpos += char_width;
     }
 }
 
 // Process graphics (Epson-specific)
-static inline void process_graphics(float gstep) {
+static inline void process_graphics(int xs) {
     if (!epson_initialized) return;  // Only for Epson
     int nl = file_get_char(fi);
     if (nl == EOF)
@@ -359,7 +733,6 @@ static inline void process_graphics(float gstep) {
         return;
     int n = nl + 256 * nh;
     print_stderr("<%d>", n);
-    float xs = gstep * step60;
     int c;
     while (n > 0) {
         c = file_get_char(fi);
@@ -374,14 +747,14 @@ static inline void process_graphics(float gstep) {
 }
 
 // Process LPI sequence (Epson-specific)
-static inline void process_lpi(float ppi) {
+static inline void process_lpi(int ppi) {
     if (!epson_initialized) return;  // Only for Epson
     int n = file_get_char(fi);
     if (n == EOF)
         return;
-    lstep = (float)n / ppi;
+    lstep = n * (DEVICE_DPI / ppi);
     // print the lstep
-    print_stderr("<%f>", lstep);
+    print_stderr("<%f>", printer_y_in(lstep));
 }
 
 // Process subscript/superscript sequence (Epson-specific)
@@ -400,18 +773,18 @@ static inline int process_sscript() {
             mode_subscript = 0;
             mode_superscript = 1;
             yoffset = 0;
-            ystep = 0.5;
+            ystep = DEVICE_DPI / 144;
             break;
         case '1':   // Subscript on
         case 1:
             mode_subscript = 1;
             mode_superscript = 0;
-            yoffset = 0.05;
-            ystep = 0.5;
+            yoffset = DEVICE_DPI / 20;   // 0.05 in
+            ystep = DEVICE_DPI / 144;
             break;
         default:
             yoffset = 0;
-            ystep = 1.0;
+            ystep = DEVICE_DPI / 72;
             result = 1;
             break;
     }
@@ -476,40 +849,40 @@ static inline int printer_process_escape() {
             mode_subscript = 0;
             mode_superscript = 0;
             yoffset = 0;
-            ystep = 1.0;
+            ystep = DEVICE_DPI / 72;
             break;
         case 'M':   // 12 cpi (Elite)
             mode_elite = 1;
             if (mode_compressed)
-                xstep = 10.0 / 20.0 / 2.0;
+                xstep = DEVICE_DPI / 240;
             else
-                xstep = 10.0 / 12.0 / 2.0;
+                xstep = DEVICE_DPI / 144;
             break;
         case 'P':   // 10 cpi (Pica)
             mode_elite = 0;
             if (mode_compressed)
-                xstep = 10.0 / 17.16 / 2.0;
+                xstep = EPSON_COMPRESSED_XSTEP;
             else
-                xstep = 0.5;
+                xstep = DEVICE_DPI / 120;
             break;
         case '-':   // Underline mode
             process_underline();
             break;
         case 'K':   // 60dpi graphics
-            process_graphics(1.0);
+            process_graphics(DEVICE_DPI / 60);
             break;
         case 'L':   // 120dpi graphics
         case 'Y':   // 120dpi graphics (fast)
-            process_graphics(0.5);
+            process_graphics(DEVICE_DPI / 120);
             break;
         case '0':   // Set LPI = 1/8 in
-            lstep = 1.0 / 8.0;
+            lstep = DEVICE_DPI / 8;
             break;
         case '1':   // Set LPI = 7/72 in
-            lstep = 7.0 / 72.0;
+            lstep = 7 * (DEVICE_DPI / 72);
             break;
         case '2':   // Set LPI = 1/6 in
-            lstep = 1.0 / 6.0;
+            lstep = DEVICE_DPI / 6;
             break;
         case 'A':   // Set LPI n/72 in
             process_lpi(72);
@@ -537,11 +910,10 @@ static inline void process_ff() {
 // Process backspace (Epson-specific)
 static inline void process_bs() {
     if (!epson_initialized) return;  // Only for Epson
-    float xs = xstep * step60;
     if (mode_wide1line || mode_wide) {
-        xpos -= xs * 24.0;
+        xpos -= xstep * 24;
     } else {
-        xpos -= xs * 12.0;
+        xpos -= xstep * 12;
     }
     if (xpos < page_xmargin)
         xpos = page_xmargin;
@@ -622,16 +994,15 @@ static inline int epson_process_char(int c) {
         case 9:     // HT (Horizontal Tab)
             {
                 // Tab stops at every TAB_STOPS characters (standard for Epson printers)
-                float xs = xstep * step60; // width per dot column
-                float char_width = xs * 12.0; // width of one character (12 dot columns)
+                int char_width = xstep * 12; // width of one character (12 dot columns)
                 if (mode_wide || mode_wide1line) {
-                    char_width = xs * 24.0; // double width
+                    char_width = xstep * 24; // double width
                 }
-                float current_col = (xpos - page_xmargin) / char_width;
-                int next_tab_stop = ((int)(current_col / TAB_STOPS) + 1) * TAB_STOPS;
+                int current_col = (xpos - page_xmargin) / char_width;
+                int next_tab_stop = (current_col / TAB_STOPS + 1) * TAB_STOPS;
                 xpos = page_xmargin + (next_tab_stop * char_width);
                 // Don't go past right margin
-                if (xpos > page_xmargin + page_width) {
+                if (printer_x_in(xpos - page_xmargin) > page_width) {
                     xpos = page_xmargin;
                 }
             }
@@ -655,16 +1026,16 @@ static inline int epson_process_char(int c) {
         case 15:    // SI (compressed)
             mode_compressed = 1;
             if (mode_elite)
-                xstep = 10.0 / 20.0 / 2.0;
+                xstep = DEVICE_DPI / 240;
             else
-                xstep = 10.0 / 17.16 / 2.0;
+                xstep = EPSON_COMPRESSED_XSTEP;
             break;
         case 18:   // DC2 (pica)
             mode_compressed = 0;
             if (mode_elite)
-                xstep = 10.0 / 12.0 / 2.0;
+                xstep = DEVICE_DPI / 144;
             else
-                xstep = 0.5;
+                xstep = DEVICE_DPI / 120;
             break;
         case 14:    // SO (expanded on)
             mode_wide = 1;
@@ -697,15 +1068,15 @@ static inline int hammer_process_char(int c) {
         case 9:     // HT (Horizontal Tab)
             {
                 // Tab stops at every TAB_STOPS characters (standard)
-                float char_width = 1.0f / page_cpi; // width of one character in inches
-                float current_col = (xpos - page_xmargin) / char_width;
-                int next_tab_stop = ((int)(current_col / TAB_STOPS) + 1) * TAB_STOPS;
+                int char_width = DEVICE_DPI / page_cpi; // width of one character
+                int current_col = (xpos - page_xmargin) / char_width;
+                int next_tab_stop = (current_col / TAB_STOPS + 1) * TAB_STOPS;
                 xpos = page_xmargin + (next_tab_stop * char_width);
                 // Don't go past right margin
-                if (xpos > page_width) {
+                if (printer_x_in(xpos) > page_width) {
                     xpos = page_xmargin;
-                    ypos += 1.0 / page_lpi; // advance to next line
-                    if (ypos >= page_height) {
+                    ypos += DEVICE_DPI / page_lpi; // advance to next line
+                    if (ypos >= (int)(page_height * DEVICE_DPI)) {
                         pdf_new_page();
                         ypos = page_ymargin;
                     }
@@ -713,8 +1084,8 @@ static inline int hammer_process_char(int c) {
             }
             break;
         case 10:    // LF
-            ypos += 1.0 / page_lpi;
-            if (ypos >= page_height) {
+            ypos += DEVICE_DPI / page_lpi;
+            if (ypos >= (int)(page_height * DEVICE_DPI)) {
                 pdf_new_page();
                 ypos = page_ymargin;
             }
@@ -0,0 +1,624 @@
+#ifndef RASTER_H
+#define RASTER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "deflate.h"
+#include "g4.h"
+#include "ttf.h"
+
+// --- Raster output ---
+// Instead of a PDF, every page is rendered into an 8-bit grayscale buffer
+// (255 = paper white) and written as a PGM or PNG image. Dots are stamped
+// from anti-aliased sprites prepared once per dot radius for each sub-pixel
+// phase, and blended with a per-pixel minimum (ink only darkens the paper),
+// sixteen pixels at a time where SSE2 is available. Font glyphs (1403) are
+// rendered from their TrueType outlines into the same kind of sprites, once
+// per character and phase.
+//
+// Coordinates are PDF points with the origin at the bottom-left corner, as
+// in the PDF writer. PGM pages are concatenated into one stream (a
+// multi-image PGM); PNG writes one file per page, page N > 1 going to the
+// output name with "-N" inserted before the extension. TIFF writes one
+// bilevel CCITT G4 image per page into a single multi-page file.
+
+#define RASTER_NONE 0
+#define RASTER_PGM 1
+#define RASTER_PNG 2
+#define RASTER_TIFF 3
+
+#define RASTER_PHASES 4                       // sub-pixel positions per axis with their own sprite
+#define RASTER_SUPERSAMPLE 8                  // coverage samples per pixel and axis when building sprites
+#define RASTER_MAX_SPRITES 4                  // dot radii with prepared sprites
+#define RASTER_PAD 16                         // bytes after each row, so a sprite row can be blended whole
+
+extern int raster_format;                     // RASTER_* (RASTER_NONE = write a PDF)
+extern int raster_dpi;                        // pixels per inch
+extern int pdf_compress_level;                // also the PNG compression level
+
+// Sprites of one dot radius: RASTER_PHASES^2 images of size x size pixels,
+// rows padded to a multiple of 16 bytes with white
+typedef struct {
+    float radius_pt;
+    int size;                                 // pixels per side
+    int reach;                                // pixels from the center pixel to the sprite edge
+    int row;                                  // bytes per sprite row
+    unsigned char *data;
+} raster_sprite;
+
+static raster_sprite raster_sprites[RASTER_MAX_SPRITES];
+static int raster_sprite_count = 0;
+
+// Glyph sprite of one character at one sub-pixel phase: w x h pixels, rows
+// padded to a multiple of 16 bytes with white, placed with its top-left
+// corner at (x0, y0) pixels from the pixel holding the glyph origin
+typedef struct {
+    int x0, y0;
+    int w, h;
+    int row;
+    unsigned char *data;                      // NULL for a glyph without ink
+} raster_glyph;
+
+static raster_glyph *raster_glyphs[256 * RASTER_PHASES * RASTER_PHASES];
+static float raster_glyph_size = 0.0f;        // font size the glyphs were rendered at (points)
+
+static FILE *raster_out = NULL;
+static const char *raster_path = NULL;        // output name, for PNG pages after the first
+static unsigned char *raster_page = NULL;
+static int raster_width = 0;                  // page size in pixels
+static int raster_height = 0;
+static int raster_stride = 0;                 // bytes per row (width + RASTER_PAD)
+static float raster_scale = 1.0f;             // pixels per point
+static int raster_page_open = 0;
+static int raster_pages = 0;                  // pages written
+static int raster_error = 0;
+
+// A TIFF page is written when the next one starts (or at the end), once it
+// is known whether another IFD follows it
+static unsigned char *raster_tiff_strip = NULL;   // G4 data of the page waiting to be written
+static size_t raster_tiff_len = 0;
+static int raster_tiff_width = 0;
+static int raster_tiff_height = 0;
+static int raster_tiff_page = 0;              // its page number (0 = first)
+static unsigned long raster_tiff_pos = 0;     // bytes written to the TIFF file
+
+static inline int raster_floor(float v) {
+    int i = (int)v;
+    return i - (v < (float)i);
+}
+
+static inline int raster_ceil(float v) {
+    return -raster_floor(-v);
+}
+
+// Coverage (0-1) of the pixel whose top-left corner is (px, py) by a circle
+// of radius r centered at (cx, cy), all in pixels
+static float raster_coverage(float px, float py, float cx, float cy, float r) {
+    int inside = 0;
+    for (int sy = 0; sy < RASTER_SUPERSAMPLE; sy++) {
+        float y = py + (sy + 0.5f) / RASTER_SUPERSAMPLE - cy;
+        for (int sx = 0; sx < RASTER_SUPERSAMPLE; sx++) {
+            float x = px + (sx + 0.5f) / RASTER_SUPERSAMPLE - cx;
+            if (x * x + y * y <= r * r) inside++;
+        }
+    }
+    return (float)inside / (RASTER_SUPERSAMPLE * RASTER_SUPERSAMPLE);
+}
+
+// Find or build the sprites for dots of radius_pt
+static raster_sprite *raster_sprite_for(float radius_pt) {
+    for (int i = 0; i < raster_sprite_count; i++) {
+        if (raster_sprites[i].radius_pt == radius_pt) return &raster_sprites[i];
+    }
+    raster_sprite *s = &raster_sprites[raster_sprite_count < RASTER_MAX_SPRITES ? raster_sprite_count++ : RASTER_MAX_SPRITES - 1];
+    free(s->data);
+    float r = radius_pt * raster_scale;
+    s->radius_pt = radius_pt;
+    s->reach = raster_ceil(r) + 1;
+    s->size = 2 * s->reach + 1;
+    s->row = (s->size + 15) & ~15;
+    s->data = (unsigned char*)malloc((size_t)RASTER_PHASES * RASTER_PHASES * s->size * s->row);
+    memset(s->data, 255, (size_t)RASTER_PHASES * RASTER_PHASES * s->size * s->row);
+    for (int py = 0; py < RASTER_PHASES; py++) {
+        for (int px = 0; px < RASTER_PHASES; px++) {
+            unsigned char *img = s->data + (size_t)(py * RASTER_PHASES + px) * s->size * s->row;
+            // center within the center pixel for this phase
+            float cx = s->reach + (px + 0.5f) / RASTER_PHASES;
+            float cy = s->reach + (py + 0.5f) / RASTER_PHASES;
+            for (int y = 0; y < s->size; y++) {
+                for (int x = 0; x < s->size; x++) {
+                    float c = raster_coverage((float)x, (float)y, cx, cy, r);
+                    img[y * s->row + x] = (unsigned char)(255.0f - c * 255.0f + 0.5f);
+                }
+            }
+        }
+    }
+    return s;
+}
+
+// dst = min(dst, src) over n bytes
+static inline void raster_min_row(unsigned char *dst, const unsigned char *src, int n) {
+#ifdef __SSE2__
+    for (; n >= 16; n -= 16, dst += 16, src += 16) {
+        __m128i d = _mm_loadu_si128((const __m128i*)dst);
+        _mm_storeu_si128((__m128i*)dst, _mm_min_epu8(d, _mm_loadu_si128((const __m128i*)src)));
+    }
+#endif
+    for (int i = 0; i < n; i++) {
+        if (src[i] < dst[i]) dst[i] = src[i];
+    }
+}
+
+// Pixel position of (x, y) points: the pixel in *ix, *iy and the
+// sub-pixel phase in *px, *py
+static void raster_locate(float x_pt, float y_pt, int *ix, int *iy, int *px, int *py) {
+    float x = x_pt * raster_scale;
+    float y = (float)raster_height - y_pt * raster_scale;
+    *ix = raster_floor(x);
+    *iy = raster_floor(y);
+    *px = (int)((x - *ix) * RASTER_PHASES);
+    *py = (int)((y - *iy) * RASTER_PHASES);
+    if (*px >= RASTER_PHASES) *px = RASTER_PHASES - 1;
+    if (*py >= RASTER_PHASES) *py = RASTER_PHASES - 1;
+}
+
+// Blend the w x h sprite img (rows row bytes apart, padded with white to a
+// multiple of 16) into the page with its top-left corner at (x0, y0)
+// pixels. Ink is lightened to gray (0 = black) first.
+static void raster_blend(const unsigned char *img, int row, int w, int h, int x0, int y0, unsigned char gray) {
+    if (gray == 0 && x0 >= 0 && y0 >= 0 && x0 + w <= raster_width && y0 + h <= raster_height) {
+        // whole rows (the padding after each page row absorbs the sprite padding)
+        unsigned char *dst = raster_page + (size_t)y0 * raster_stride + x0;
+        for (int r = 0; r < h; r++, dst += raster_stride, img += row) raster_min_row(dst, img, row);
+        return;
+    }
+    // clipped at the page edge, or shaded
+    for (int r = 0; r < h; r++) {
+        int yy = y0 + r;
+        if (yy < 0 || yy >= raster_height) continue;
+        for (int c = 0; c < w; c++) {
+            int xx = x0 + c;
+            if (xx < 0 || xx >= raster_width) continue;
+            unsigned char *d = raster_page + (size_t)yy * raster_stride + xx;
+            unsigned v = img[r * row + c];
+            if (gray) v = 255 - (255 - v) * (255u - gray) / 255;
+            if (v < *d) *d = (unsigned char)v;
+        }
+    }
+}
+
+// Stamp a dot of radius r_pt centered at (cx, cy) points
+static void raster_dot(float cx, float cy, float r_pt) {
+    if (!raster_page_open) return;
+    raster_sprite *s = raster_sprite_for(r_pt);
+    int ix, iy, px, py;
+    raster_locate(cx, cy, &ix, &iy, &px, &py);
+    const unsigned char *img = s->data + (size_t)(py * RASTER_PHASES + px) * s->size * s->row;
+    raster_blend(img, s->row, s->size, s->size, ix - s->reach, iy - s->reach, 0);
+}
+
+// Add the coverage of the line from (x0, y0) to (x1, y1) pixels to the
+// accumulation buffer acc (w columns, h rows). Each pixel receives the
+// signed area the line's edge covers in it; a running sum along the row
+// then gives the coverage of the filled outline.
+static void raster_acc_line(float *acc, int w, int h, float x0, float y0, float x1, float y1) {
+    if (y0 == y1) return;
+    float dir = 1.0f;
+    if (y0 > y1) {
+        float t = x0; x0 = x1; x1 = t;
+        t = y0; y0 = y1; y1 = t;
+        dir = -1.0f;
+    }
+    float dxdy = (x1 - x0) / (y1 - y0);
+    float x = x0;
+    int ystart = raster_floor(y0);
+    if (ystart < 0) {
+        x -= y0 * dxdy;
+        ystart = 0;
+    }
+    int yend = raster_ceil(y1);
+    if (yend > h) yend = h;
+    for (int y = ystart; y < yend; y++) {
+        float *line = acc + (size_t)y * w;
+        float top = (float)y > y0 ? (float)y : y0;
+        float bottom = (float)(y + 1) < y1 ? (float)(y + 1) : y1;
+        float dy = bottom - top;
+        float xnext = x + dxdy * dy;
+        float d = dy * dir;
+        float xa = x < xnext ? x : xnext, xb = x < xnext ? xnext : x;
+        int xai = raster_floor(xa), xbi = raster_ceil(xb);
+        if (xai < 0 || xbi + 1 >= w) {
+            x = xnext;
+            continue;
+        }
+        if (xbi <= xai + 1) {
+            // within one pixel: split at the mean x
+            float xm = 0.5f * (x + xnext) - xai;
+            line[xai] += d - d * xm;
+            line[xai + 1] += d * xm;
+        } else {
+            // across several pixels: trapezoid areas
+            float s = 1.0f / (xb - xa);
+            float xaf = xa - xai;
+            float a0 = 0.5f * s * (1.0f - xaf) * (1.0f - xaf);
+            float xbf = xb - xbi + 1.0f;
+            float am = 0.5f * s * xbf * xbf;
+            line[xai] += d * a0;
+            if (xbi == xai + 2) {
+                line[xai + 1] += d * (1.0f - a0 - am);
+            } else {
+                float a1 = s * (1.5f - xaf);
+                line[xai + 1] += d * (a1 - a0);
+                for (int xi = xai + 2; xi < xbi - 1; xi++) line[xi] += d * s;
+                float a2 = a1 + (xbi - xai - 3) * s;
+                line[xbi - 1] += d * (1.0f - a2 - am);
+            }
+            line[xbi] += d * am;
+        }
+        x = xnext;
+    }
+}
+
+// Render character code of the TrueType font at size_pt points for the
+// sub-pixel phase (px, py)
+static raster_glyph *raster_render_glyph(const unsigned char *font, size_t len, int code, float size_pt, int px, int py) {
+    raster_glyph *g = (raster_glyph*)calloc(1, sizeof(raster_glyph));
+    ttf_outline o = {0};
+    int upem = ttf_char_outline(font, len, (unsigned)code, &o);
+    if (!upem || o.count == 0) {
+        free(o.seg);
+        return g;
+    }
+    // font units to pixels relative to the origin pixel (y down)
+    float k = size_pt * raster_scale / upem;
+    float ox = (px + 0.5f) / RASTER_PHASES, oy = (py + 0.5f) / RASTER_PHASES;
+    float minx = o.seg[0].x0, maxx = minx, miny = o.seg[0].y0, maxy = miny;
+    for (int i = 0; i < o.count; i++) {
+        const float *v = &o.seg[i].x0;
+        for (int j = 0; j < 6; j += 2) {
+            if (v[j] < minx) minx = v[j];
+            if (v[j] > maxx) maxx = v[j];
+            if (v[j + 1] < miny) miny = v[j + 1];
+            if (v[j + 1] > maxy) maxy = v[j + 1];
+        }
+    }
+    g->x0 = raster_floor(ox + minx * k) - 1;
+    g->y0 = raster_floor(oy - maxy * k) - 1;
+    g->w = raster_ceil(ox + maxx * k) - g->x0 + 2;
+    g->h = raster_ceil(oy - miny * k) - g->y0 + 1;
+    g->row = (g->w + 15) & ~15;
+    int aw = g->w + 2;
+    float *acc = (float*)calloc((size_t)aw * g->h, sizeof(float));
+    float dx = ox - g->x0, dy = oy - g->y0;
+    for (int i = 0; i < o.count; i++) {
+        const ttf_segment *sg = &o.seg[i];
+        float x0 = dx + sg->x0 * k, y0 = dy - sg->y0 * k;
+        float x1 = dx + sg->x1 * k, y1 = dy - sg->y1 * k;
+        if (sg->cx == sg->x0 && sg->cy == sg->y0) {
+            raster_acc_line(acc, aw, g->h, x0, y0, x1, y1);
+            continue;
+        }
+        // flatten the quadratic curve: about one line per two pixels of control polygon
+        float cx = dx + sg->cx * k, cy = dy - sg->cy * k;
+        float ex = x0 - 2.0f * cx + x1, ey = y0 - 2.0f * cy + y1;
+        int n = 1 + (int)((ex < 0 ? -ex : ex) + (ey < 0 ? -ey : ey));
+        if (n > 16) n = 16;
+        float lx = x0, ly = y0;
+        for (int t = 1; t <= n; t++) {
+            float u = (float)t / n, w = 1.0f - u;
+            float nx = w * w * x0 + 2.0f * u * w * cx + u * u * x1;
+            float ny = w * w * y0 + 2.0f * u * w * cy + u * u * y1;
+            raster_acc_line(acc, aw, g->h, lx, ly, nx, ny);
+            lx = nx;
+            ly = ny;
+        }
+    }
+    free(o.seg);
+    g->data = (unsigned char*)malloc((size_t)g->row * g->h);
+    memset(g->data, 255, (size_t)g->row * g->h);
+    for (int y = 0; y < g->h; y++) {
+        float sum = 0.0f;
+        for (int x = 0; x < g->w; x++) {
+            sum += acc[(size_t)y * aw + x];
+            float c = sum < 0 ? -sum : sum;
+            if (c > 1.0f) c = 1.0f;
+            g->data[(size_t)y * g->row + x] = (unsigned char)(255.0f - c * 255.0f + 0.5f);
+        }
+    }
+    free(acc);
+    return g;
+}
+
+// Draw character code of the TrueType font (len bytes) at size_pt with its
+// origin at (x, y) points, in gray (0 = black)
+static void raster_draw_glyph(const unsigned char *font, size_t len, int code, float x, float y, float size_pt, unsigned char gray) {
+    if (!raster_page_open) return;
+    if (size_pt != raster_glyph_size) {
+        for (int i = 0; i < 256 * RASTER_PHASES * RASTER_PHASES; i++) {
+            if (raster_glyphs[i]) free(raster_glyphs[i]->data);
+            free(raster_glyphs[i]);
+            raster_glyphs[i] = NULL;
+        }
+        raster_glyph_size = size_pt;
+    }
+    int ix, iy, px, py;
+    raster_locate(x, y, &ix, &iy, &px, &py);
+    raster_glyph **slot = &raster_glyphs[(code & 0xFF) * RASTER_PHASES * RASTER_PHASES + py * RASTER_PHASES + px];
+    if (!*slot) *slot = raster_render_glyph(font, len, code & 0xFF, size_pt, px, py);
+    raster_glyph *g = *slot;
+    if (g->data) raster_blend(g->data, g->row, g->w, g->h, ix + g->x0, iy + g->y0, gray);
+}
+
+// Fill a circle of radius r points centered at (cx, cy) with gray
+static void raster_fill_circle(float cx, float cy, float r_pt, unsigned char gray) {
+    if (!raster_page_open) return;
+    float x = cx * raster_scale, y = (float)raster_height - cy * raster_scale, r = r_pt * raster_scale;
+    int x0 = raster_floor(x - r), x1 = raster_ceil(x + r), y0 = raster_floor(y - r), y1 = raster_ceil(y + r);
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 > raster_width) x1 = raster_width;
+    if (y1 > raster_height) y1 = raster_height;
+    for (int yy = y0; yy < y1; yy++) {
+        unsigned char *row = raster_page + (size_t)yy * raster_stride;
+        for (int xx = x0; xx < x1; xx++) {
+            float c = raster_coverage((float)xx, (float)yy, x, y, r);
+            unsigned char v = (unsigned char)(255.0f - c * (255.0f - gray) + 0.5f);
+            if (v < row[xx]) row[xx] = v;
+        }
+    }
+}
+
+// Fill the rectangle with corner (x, y) and size w x h points with gray
+static void raster_fill_rect(float x, float y, float w, float h, unsigned char gray) {
+    if (!raster_page_open) return;
+    int x0 = raster_floor(x * raster_scale + 0.5f), x1 = raster_floor((x + w) * raster_scale + 0.5f);
+    int y0 = raster_height - raster_floor((y + h) * raster_scale + 0.5f), y1 = raster_height - raster_floor(y * raster_scale + 0.5f);
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 > raster_width) x1 = raster_width;
+    if (y1 > raster_height) y1 = raster_height;
+    if (x1 <= x0) return;
+    unsigned char *fill = (unsigned char*)malloc((size_t)(x1 - x0));
+    memset(fill, gray, (size_t)(x1 - x0));
+    for (int yy = y0; yy < y1; yy++) raster_min_row(raster_page + (size_t)yy * raster_stride + x0, fill, x1 - x0);
+    free(fill);
+}
+
+// --- Image files ---
+
+static unsigned long raster_crc_table[256];
+
+static unsigned long raster_crc(unsigned long crc, const unsigned char *p, size_t len) {
+    if (!raster_crc_table[1]) {
+        for (unsigned n = 0; n < 256; n++) {
+            unsigned long c = n;
+            for (int k = 0; k < 8; k++) c = c & 1 ? 0xEDB88320UL ^ (c >> 1) : c >> 1;
+            raster_crc_table[n] = c;
+        }
+    }
+    crc ^= 0xFFFFFFFFUL;
+    for (size_t i = 0; i < len; i++) crc = raster_crc_table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFFUL;
+}
+
+static void raster_put32(unsigned char *p, unsigned long v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+static void raster_png_chunk(FILE *f, const char *type, const unsigned char *data, size_t len) {
+    unsigned char head[8];
+    raster_put32(head, (unsigned long)len);
+    memcpy(head + 4, type, 4);
+    unsigned long crc = raster_crc(raster_crc(0, head + 4, 4), data, len);
+    unsigned char tail[4];
+    raster_put32(tail, crc);
+    fwrite(head, 1, 8, f);
+    fwrite(data, 1, len, f);
+    fwrite(tail, 1, 4, f);
+}
+
+// Write the page as an 8-bit grayscale PNG. Rows use the Up filter, which
+// turns the long runs of identical rows (paper, guide bands) into zeros.
+static void raster_write_png(FILE *f) {
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    unsigned char ihdr[13];
+    raster_put32(ihdr, (unsigned long)raster_width);
+    raster_put32(ihdr + 4, (unsigned long)raster_height);
+    ihdr[8] = 8;                              // bit depth
+    ihdr[9] = 0;                              // grayscale
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;       // deflate, adaptive filtering, no interlace
+    size_t raw_len = (size_t)(raster_width + 1) * raster_height;
+    unsigned char *raw = (unsigned char*)malloc(raw_len);
+    for (int y = 0; y < raster_height; y++) {
+        unsigned char *out = raw + (size_t)y * (raster_width + 1);
+        const unsigned char *row = raster_page + (size_t)y * raster_stride;
+        out[0] = 2;
+        if (y == 0) {
+            memcpy(out + 1, row, (size_t)raster_width);
+        } else {
+            const unsigned char *up = row - raster_stride;
+            for (int x = 0; x < raster_width; x++) out[1 + x] = (unsigned char)(row[x] - up[x]);
+        }
+    }
+    size_t z_len = 0;
+    unsigned char *z = deflate_zlib(raw, raw_len, pdf_compress_level >= 0 ? pdf_compress_level : 6, &z_len);
+    fwrite(signature, 1, 8, f);
+    raster_png_chunk(f, "IHDR", ihdr, sizeof(ihdr));
+    raster_png_chunk(f, "IDAT", z, z_len);
+    raster_png_chunk(f, "IEND", NULL, 0);
+    free(z);
+    free(raw);
+}
+
+static void raster_put16le(unsigned char *p, unsigned v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+}
+
+static void raster_put32le(unsigned char *p, unsigned long v) {
+    raster_put16le(p, (unsigned)(v & 0xFFFF));
+    raster_put16le(p + 2, (unsigned)(v >> 16));
+}
+
+// Write the waiting TIFF page: its IFD, the resolution values and the G4
+// strip. last is nonzero if no page follows it.
+static void raster_tiff_write(int last) {
+    if (!raster_tiff_strip) return;
+    enum { TIFF_SHORT = 3, TIFF_LONG = 4, TIFF_RATIONAL = 5, TIFF_ENTRIES = 16 };
+    if (raster_tiff_pos == 0) {
+        // little-endian header, first IFD right after it
+        static const unsigned char header[8] = { 'I', 'I', 42, 0, 8, 0, 0, 0 };
+        fwrite(header, 1, 8, raster_out);
+        raster_tiff_pos = 8;
+    }
+    unsigned long ifd = raster_tiff_pos;
+    unsigned long res = ifd + 2 + TIFF_ENTRIES * 12 + 4;
+    unsigned long strip = res + 16;
+    unsigned long next = last ? 0 : strip + raster_tiff_len + (raster_tiff_len & 1);
+    const unsigned long entries[TIFF_ENTRIES][3] = {
+        { 254, TIFF_LONG, 2 },                                    // NewSubfileType: page of a multi-page image
+        { 256, TIFF_LONG, (unsigned long)raster_tiff_width },    // ImageWidth
+        { 257, TIFF_LONG, (unsigned long)raster_tiff_height },   // ImageLength
+        { 258, TIFF_SHORT, 1 },                                   // BitsPerSample
+        { 259, TIFF_SHORT, 4 },                                   // Compression: CCITT T.6
+        { 262, TIFF_SHORT, 0 },                                   // PhotometricInterpretation: WhiteIsZero
+        { 266, TIFF_SHORT, 1 },                                   // FillOrder: most significant bit first
+        { 273, TIFF_LONG, strip },                                // StripOffsets
+        { 277, TIFF_SHORT, 1 },                                   // SamplesPerPixel
+        { 278, TIFF_LONG, (unsigned long)raster_tiff_height },   // RowsPerStrip
+        { 279, TIFF_LONG, (unsigned long)raster_tiff_len },      // StripByteCounts
+        { 282, TIFF_RATIONAL, res },                              // XResolution
+        { 283, TIFF_RATIONAL, res + 8 },                          // YResolution
+        { 293, TIFF_LONG, 0 },                                    // T6Options
+        { 296, TIFF_SHORT, 2 },                                   // ResolutionUnit: inch
+        { 297, TIFF_SHORT, (unsigned long)raster_tiff_page }     // PageNumber (total unknown while streaming)
+    };
+    unsigned char buf[2 + TIFF_ENTRIES * 12 + 4 + 16];
+    raster_put16le(buf, TIFF_ENTRIES);
+    for (int i = 0; i < TIFF_ENTRIES; i++) {
+        unsigned char *e = buf + 2 + i * 12;
+        raster_put16le(e, (unsigned)entries[i][0]);
+        raster_put16le(e + 2, (unsigned)entries[i][1]);
+        raster_put32le(e + 4, entries[i][0] == 297 ? 2 : 1);
+        raster_put32le(e + 8, entries[i][2]);
+    }
+    raster_put32le(buf + 2 + TIFF_ENTRIES * 12, next);
+    for (int i = 0; i < 2; i++) {
+        raster_put32le(buf + res - ifd + i * 8, (unsigned long)raster_dpi);
+        raster_put32le(buf + res - ifd + i * 8 + 4, 1);
+    }
+    fwrite(buf, 1, sizeof(buf), raster_out);
+    fwrite(raster_tiff_strip, 1, raster_tiff_len, raster_out);
+    if (raster_tiff_len & 1) fputc(0, raster_out);
+    raster_tiff_pos = strip + raster_tiff_len + (raster_tiff_len & 1);
+    free(raster_tiff_strip);
+    raster_tiff_strip = NULL;
+    if (ferror(raster_out)) raster_error = 1;
+}
+
+// File name of page n > 1 of a one-file-per-page output: path with "-n"
+// inserted before the extension (malloc'd)
+static char *raster_page_name(const char *path, int n) {
+    const char *dot = strrchr(path, '.');
+    const char *slash = strrchr(path, '/');
+    size_t stem = dot && (!slash || dot > slash) ? (size_t)(dot - path) : strlen(path);
+    char *name = (char*)malloc(strlen(path) + 16);
+    sprintf(name, "%.*s-%d%s", (int)stem, path, n, path + stem);
+    return name;
+}
+
+// Write the current page to its file
+static void raster_write_page() {
+    raster_pages++;
+    if (raster_format == RASTER_TIFF) {
+        // the previous page is followed by this one
+        raster_tiff_write(0);
+        raster_tiff_strip = g4_encode(raster_page, raster_width, raster_height, (size_t)raster_stride, &raster_tiff_len);
+        raster_tiff_width = raster_width;
+        raster_tiff_height = raster_height;
+        raster_tiff_page = raster_pages - 1;
+        return;
+    }
+    if (raster_format == RASTER_PGM) {
+        fprintf(raster_out, "P5\n%d %d\n255\n", raster_width, raster_height);
+        for (int y = 0; y < raster_height; y++) fwrite(raster_page + (size_t)y * raster_stride, 1, (size_t)raster_width, raster_out);
+        if (ferror(raster_out)) raster_error = 1;
+        return;
+    }
+    if (raster_pages == 1) {
+        raster_write_png(raster_out);
+        if (ferror(raster_out)) raster_error = 1;
+        return;
+    }
+    if (!raster_path) {
+        fprintf(stderr, "Warning: page %d not written (PNG output to stdout holds one page)\n", raster_pages);
+        return;
+    }
+    char *name = raster_page_name(raster_path, raster_pages);
+    FILE *f = fopen(name, "wb");
+    if (!f) {
+        fprintf(stderr, "Error opening file %s\n", name);
+        raster_error = 1;
+    } else {
+        raster_write_png(f);
+        if (ferror(f) | fclose(f)) raster_error = 1;
+    }
+    free(name);
+}
+
+// Start raster output to out; path is its file name (NULL for stdout)
+void raster_init(FILE *out, const char *path) {
+    raster_out = out;
+    raster_path = path;
+    raster_scale = raster_dpi / 72.0f;
+    raster_page_open = 0;
+    raster_pages = 0;
+    raster_error = 0;
+    raster_tiff_pos = 0;
+    free(raster_tiff_strip);
+    raster_tiff_strip = NULL;
+    raster_glyph_size = 0.0f;                 // glyphs are rendered again at this resolution
+    for (int i = 0; i < raster_sprite_count; i++) free(raster_sprites[i].data);
+    memset(raster_sprites, 0, sizeof(raster_sprites));
+    raster_sprite_count = 0;
+}
+
+// Write the open page, if any
+void raster_flush_page() {
+    if (!raster_page_open) return;
+    raster_write_page();
+    raster_page_open = 0;
+}
+
+// Write the open page and start a blank one of w x h points
+void raster_new_page(float w_pt, float h_pt) {
+    raster_flush_page();
+    int w = raster_ceil(w_pt * raster_scale - 0.001f), h = raster_ceil(h_pt * raster_scale - 0.001f);
+    if (w != raster_width || h != raster_height || !raster_page) {
+        raster_width = w;
+        raster_height = h;
+        raster_stride = w + RASTER_PAD;
+        free(raster_page);
+        raster_page = (unsigned char*)malloc((size_t)raster_stride * h + RASTER_PAD);
+    }
+    memset(raster_page, 255, (size_t)raster_stride * h + RASTER_PAD);
+    raster_page_open = 1;
+}
+
+// Write the last page. Returns nonzero if writing failed.
+int raster_finish() {
+    raster_flush_page();
+    raster_tiff_write(1);
+    fflush(raster_out);
+    return raster_error || ferror(raster_out) ? 1 : 0;
+}
+
+#endif // RASTER_H
@@ -0,0 +1,400 @@
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "printer.h"
+
+// --- Spool mode ---
+// With -W the emulator stays resident and converts every file that lands in
+// a spool directory, to its name with the extension of the output format in
+// the -o directory. A file is picked up when it is closed after writing or
+// renamed into the directory (inotify IN_CLOSE_WRITE, IN_MOVED_TO), and the
+// files already there are picked up at startup. Names starting with '.' are
+// ignored, so a writer can fill ".name" and rename it when complete.
+//
+// The conversions run in -j worker processes forked once, after the charset
+// is rotated and the font is loaded, and kept for the life of the daemon.
+// The daemon hands each idle worker one name through its pipe; the worker
+// converts it as a batch job (the command line options, a printer just
+// switched on), removes the input and reports back on a pipe shared by all
+// workers. The output is written under its name with a leading '.' and
+// renamed when complete, so the output directory never shows a partial
+// file. An input that fails is moved to the "failed" subdirectory of the
+// spool, as is one whose worker crashed; a crashed worker is replaced.
+// SIGINT or SIGTERM stop the daemon once the running conversions finish
+// (the workers ignore them).
+
+#define SPOOL_MAX_WORKERS 64
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <dirent.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+typedef struct {
+    pid_t pid;
+    int jobs;                                 // write end of the job pipe
+    char *name;                               // input being converted, NULL if idle
+} spool_worker;
+
+static volatile sig_atomic_t spool_stop = 0;
+
+static void spool_signal(int sig) {
+    (void)sig;
+    spool_stop = 1;
+}
+
+// Move spool file name aside to the failed directory
+static void spool_fail(const char *dir, const char *name) {
+    char from[PATH_MAX], to[PATH_MAX];
+    snprintf(from, sizeof(from), "%s/%s", dir, name);
+    snprintf(to, sizeof(to), "%s/failed/%s", dir, name);
+    if (rename(from, to) != 0)
+        fprintf(stderr, "spool: cannot move %s to %s/failed\n", name, dir);
+}
+
+// Name output is written under until it is complete: the same file name
+// with a leading '.' (malloc'd)
+static char *spool_temp_name(const char *output) {
+    const char *slash = strrchr(output, '/');
+    size_t dir = slash ? (size_t)(slash + 1 - output) : 0;
+    char *temp = (char*)malloc(strlen(output) + 2);
+    sprintf(temp, "%.*s.%s", (int)dir, output, output + dir);
+    return temp;
+}
+
+// Remove the temporary output temp and its page files
+static void spool_discard(const char *temp) {
+    unlink(temp);
+    for (int n = 2;; n++) {
+        char *page = raster_page_name(temp, n);
+        int gone = unlink(page) != 0;
+        free(page);
+        if (gone) break;
+    }
+}
+
+// Remove the temporary output of spool file name, whose conversion did not
+// finish
+static void spool_discard_job(const char *dir, const char *name, const char *outdir) {
+    char input[PATH_MAX];
+    snprintf(input, sizeof(input), "%s/%s", dir, name);
+    char *output = batch_output_name(input, outdir);
+    char *temp = spool_temp_name(output);
+    spool_discard(temp);
+    free(temp);
+    free(output);
+}
+
+// Rename the complete temporary output temp to output, the page files
+// first so every page is there once the first one appears. Returns 0 on
+// success.
+static int spool_publish(const char *temp, const char *output) {
+    struct stat st;
+    int n = 2;
+    for (;; n++) {
+        char *page = raster_page_name(temp, n);
+        int there = stat(page, &st) == 0;
+        free(page);
+        if (!there) break;
+    }
+    int result = 0;
+    while (--n >= 2) {
+        char *from = raster_page_name(temp, n);
+        char *to = raster_page_name(output, n);
+        if (rename(from, to) != 0) result = 1;
+        free(from);
+        free(to);
+    }
+    if (rename(temp, output) != 0) result = 1;
+    return result;
+}
+
+// Convert spool file name to outdir. Returns nonzero on error.
+static int spool_job(int argc, char *argv[], const char *dir, const char *name, const char *outdir,
+                     int (*options)(int argc, char *argv[], int job_argc, char *job_argv[]),
+                     int (*convert)(const char *input, const char *output)) {
+    char input[PATH_MAX];
+    snprintf(input, sizeof(input), "%s/%s", dir, name);
+    struct stat st;
+    // already converted (a file closed after writing twice is queued twice)
+    if (stat(input, &st) != 0 || !S_ISREG(st.st_mode)) return 0;
+    if (options(argc, argv, 0, NULL)) return 1;
+    char *output = batch_output_name(input, outdir);
+    char *temp = spool_temp_name(output);
+    int result = convert(input, temp);
+    if (!result && spool_publish(temp, output)) {
+        fprintf(stderr, "spool: cannot rename %s to %s\n", temp, output);
+        result = 1;
+    }
+    if (result) {
+        spool_discard(temp);
+        fprintf(stderr, "spool: error converting %s\n", name);
+        spool_fail(dir, name);
+    } else {
+        unlink(input);
+        fprintf(stderr, "spool: %s -> %s\n", name, output);
+    }
+    free(temp);
+    free(output);
+    return result;
+}
+
+// Worker process index: convert the names read from jobs until the daemon
+// closes the pipe, reporting each one done on status
+static void spool_work(int index, int jobs, int status, int argc, char *argv[], const char *dir, const char *outdir,
+                       int (*options)(int argc, char *argv[], int job_argc, char *job_argv[]),
+                       int (*convert)(const char *input, const char *output)) {
+    // a Ctrl-C reaches the whole process group: the daemon stops the
+    // workers by closing their job pipes once the conversions finish
+    signal(SIGINT, SIG_IGN);
+    signal(SIGTERM, SIG_IGN);
+    FILE *in = fdopen(jobs, "r");
+    char name[NAME_MAX + 2];
+    while (in && fgets(name, sizeof(name), in)) {
+        name[strcspn(name, "\n")] = 0;
+        spool_job(argc, argv, dir, name, outdir, options, convert);
+        unsigned char done = (unsigned char)index;
+        if (write(status, &done, 1) != 1) break;
+    }
+    _exit(0);
+}
+
+// Start worker index. Returns 0 on success.
+static int spool_spawn(spool_worker *w, int workers, int index, int status[2], int inotify,
+                       int argc, char *argv[], const char *dir, const char *outdir,
+                       int (*options)(int argc, char *argv[], int job_argc, char *job_argv[]),
+                       int (*convert)(const char *input, const char *output)) {
+    int jobs[2];
+    if (pipe(jobs) != 0) return 1;
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(jobs[0]);
+        close(jobs[1]);
+        return 1;
+    }
+    if (pid == 0) {
+        // the worker keeps its own job pipe and the status pipe only
+        for (int i = 0; i < workers; i++)
+            if (w[i].pid > 0) close(w[i].jobs);
+        close(jobs[1]);
+        close(status[0]);
+        close(inotify);
+        spool_work(index, jobs[0], status[1], argc, argv, dir, outdir, options, convert);
+    }
+    close(jobs[0]);
+    w[index].pid = pid;
+    w[index].jobs = jobs[1];
+    w[index].name = NULL;
+    return 0;
+}
+
+// Add spool file name to the queue unless it is hidden, queued or being
+// converted
+static void spool_enqueue(char ***queue, int *queued, int *queue_cap, spool_worker *w, int workers, const char *name) {
+    if (name[0] == '.' || name[0] == 0) return;
+    for (int i = 0; i < *queued; i++)
+        if (strcmp((*queue)[i], name) == 0) return;
+    for (int i = 0; i < workers; i++)
+        if (w[i].name && strcmp(w[i].name, name) == 0) return;
+    if (*queued == *queue_cap) {
+        *queue_cap = *queue_cap ? *queue_cap * 2 : 64;
+        *queue = (char**)realloc(*queue, sizeof(char*) * *queue_cap);
+    }
+    (*queue)[(*queued)++] = strdup(name);
+}
+
+// Watch spool directory dir and convert the files landing there to outdir
+// with workers processes. preload prepares what the conversions share before
+// the workers are forked. Returns when stopped by a signal, nonzero if the
+// daemon could not start.
+static int spool_run(int argc, char *argv[], const char *dir, const char *outdir, int workers,
+                     void (*preload)(void),
+                     int (*options)(int argc, char *argv[], int job_argc, char *job_argv[]),
+                     int (*convert)(const char *input, const char *output)) {
+    char failed[PATH_MAX];
+    char real_dir[PATH_MAX], real_out[PATH_MAX];
+    snprintf(failed, sizeof(failed), "%s/failed", dir);
+    if (!realpath(dir, real_dir) || !realpath(outdir, real_out)) {
+        fprintf(stderr, "spool: the spool directory %s and the output directory %s must exist\n", dir, outdir);
+        return 1;
+    }
+    if (strcmp(real_dir, real_out) == 0) {
+        fprintf(stderr, "spool: the output directory cannot be the spool directory\n");
+        return 1;
+    }
+    if (mkdir(failed, 0777) != 0 && errno != EEXIST) {
+        fprintf(stderr, "spool: cannot create %s\n", failed);
+        return 1;
+    }
+    int inotify = inotify_init1(IN_CLOEXEC);
+    if (inotify < 0 || inotify_add_watch(inotify, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        fprintf(stderr, "spool: cannot watch %s\n", dir);
+        if (inotify >= 0) close(inotify);
+        return 1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = spool_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    // what every conversion needs, shared with the workers
+    if (options(argc, argv, 0, NULL)) {
+        close(inotify);
+        return 1;
+    }
+    preload();
+
+    int status[2];
+    spool_worker w[SPOOL_MAX_WORKERS];
+    memset(w, 0, sizeof(w));
+    if (pipe(status) != 0) {
+        close(inotify);
+        return 1;
+    }
+    int result = 0;
+    for (int i = 0; i < workers && !result; i++)
+        result = spool_spawn(w, workers, i, status, inotify, argc, argv, dir, outdir, options, convert);
+    if (result) {
+        fprintf(stderr, "spool: cannot start the workers\n");
+        spool_stop = 1;
+    }
+
+    // the files spooled while the daemon was down, then the new ones
+    char **queue = NULL;
+    int queued = 0, queue_cap = 0;
+    DIR *d = opendir(dir);
+    struct dirent *e;
+    while (d && (e = readdir(d)) != NULL) {
+        char path[PATH_MAX];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+        if (stat(path, &st) == 0 && S_ISREG(st.st_mode))
+            spool_enqueue(&queue, &queued, &queue_cap, w, workers, e->d_name);
+    }
+    if (d) closedir(d);
+    fprintf(stderr, "spool: watching %s with %d worker%s\n", dir, workers, workers == 1 ? "" : "s");
+
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (!spool_stop) {
+        // hand the queue to the idle workers
+        for (int i = 0; i < workers && queued; i++) {
+            if (w[i].pid <= 0 || w[i].name) continue;
+            char *name = queue[0];
+            memmove(queue, queue + 1, sizeof(char*) * --queued);
+            size_t len = strlen(name);
+            name[len] = '\n';
+            ssize_t n = write(w[i].jobs, name, len + 1);
+            name[len] = 0;
+            if (n == (ssize_t)len + 1) {
+                w[i].name = name;
+            } else {
+                queue[queued++] = name;       // worker gone, retried once it is replaced
+                break;
+            }
+        }
+
+        struct pollfd fds[2] = { { inotify, POLLIN, 0 }, { status[0], POLLIN, 0 } };
+        int ready = poll(fds, 2, 1000);
+        if (ready < 0 && errno != EINTR) {
+            fprintf(stderr, "spool: poll failed\n");
+            result = 1;
+            break;
+        }
+        if (ready > 0 && (fds[0].revents & POLLIN)) {
+            ssize_t n = read(inotify, events, sizeof(events));
+            for (char *p = events; n > 0 && p < events + n;) {
+                struct inotify_event *ev = (struct inotify_event*)p;
+                if (ev->len && !(ev->mask & IN_ISDIR))
+                    spool_enqueue(&queue, &queued, &queue_cap, w, workers, ev->name);
+                p += sizeof(struct inotify_event) + ev->len;
+            }
+        }
+        if (ready > 0 && (fds[1].revents & POLLIN)) {
+            unsigned char done[SPOOL_MAX_WORKERS];
+            ssize_t n = read(status[0], done, sizeof(done));
+            for (ssize_t k = 0; k < n; k++) {
+                if (done[k] >= workers) continue;
+                free(w[done[k]].name);
+                w[done[k]].name = NULL;
+            }
+        }
+
+        // replace the workers that died, with their input moved aside
+        pid_t pid;
+        int st;
+        while (!spool_stop && (pid = waitpid(-1, &st, WNOHANG)) > 0) {
+            for (int i = 0; i < workers; i++) {
+                if (w[i].pid != pid) continue;
+                close(w[i].jobs);
+                w[i].pid = 0;
+                if (w[i].name) {
+                    spool_discard_job(dir, w[i].name, outdir);
+                    fprintf(stderr, "spool: worker crashed converting %s\n", w[i].name);
+                    spool_fail(dir, w[i].name);
+                    free(w[i].name);
+                    w[i].name = NULL;
+                }
+                if (spool_spawn(w, workers, i, status, inotify, argc, argv, dir, outdir, options, convert))
+                    fprintf(stderr, "spool: cannot restart a worker\n");
+            }
+        }
+    }
+
+    // closing the job pipes ends the workers after their conversion
+    for (int i = 0; i < workers; i++)
+        if (w[i].pid > 0) close(w[i].jobs);
+    for (int i = 0; i < workers; i++)
+        while (w[i].pid > 0 && waitpid(w[i].pid, NULL, 0) < 0 && errno == EINTR);
+
+    // the conversions reported done since; a worker that died in the middle
+    // of one (killed) leaves no output and the input for the next start
+    close(status[1]);
+    unsigned char done;
+    while (read(status[0], &done, 1) == 1) {
+        if (done >= workers) continue;
+        free(w[done].name);
+        w[done].name = NULL;
+    }
+    for (int i = 0; i < workers; i++) {
+        if (!w[i].name) continue;
+        spool_discard_job(dir, w[i].name, outdir);
+        fprintf(stderr, "spool: %s was not converted, left in the spool\n", w[i].name);
+        free(w[i].name);
+    }
+    for (int i = 0; i < queued; i++) free(queue[i]);
+    free(queue);
+    close(status[0]);
+    close(inotify);
+    fprintf(stderr, "spool: stopped\n");
+    return result;
+}
+
+#else
+
+static int spool_run(int argc, char *argv[], const char *dir, const char *outdir, int workers,
+                     void (*preload)(void),
+                     int (*options)(int argc, char *argv[], int job_argc, char *job_argv[]),
+                     int (*convert)(const char *input, const char *output)) {
+    (void)argc; (void)argv; (void)dir; (void)outdir; (void)workers;
+    (void)preload; (void)options; (void)convert;
+    fprintf(stderr, "Spool mode needs inotify (Linux)\n");
+    return 1;
+}
+
+#endif
+
+#endif // SPOOL_H
@@ -0,0 +1,328 @@
+#ifndef SVG_H
+#define SVG_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "raster.h"
+#include "ttf.h"
+
+// --- SVG output ---
+// Instead of a PDF, every page is written as an SVG document for previews
+// in a browser. Geometry is defined once and placed by reference: each dot
+// size is a <symbol> holding one circle, each character glyph a <g> in
+// <defs> (Epson glyphs as <use>s of the dot symbol, 1403 glyphs as one
+// path from the TrueType outline), and the page body is a list of
+// <use x y> elements. A page's <defs> list only the glyphs it places.
+//
+// Coordinates are PDF points with the origin at the bottom-left corner, as
+// in the PDF writer, and are flipped to SVG's top-left origin here. Page 1
+// goes to the output file; page N > 1 goes to the output name with "-N"
+// inserted before the extension, as for PNG images.
+
+#define SVG_FONT_TTF -1                       // glyph font of the embedded TrueType font (1403)
+
+extern int svg_output;                        // nonzero: write SVG pages instead of a PDF
+
+typedef struct {
+    int font;                                 // Type3 variant or SVG_FONT_TTF
+    int code;
+    char *def;                                // children of the glyph's <g>
+    size_t len;
+    int page;                                 // last page that placed the glyph (1-based)
+} svg_glyph;
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} svg_buf;
+
+static FILE *svg_out = NULL;
+static const char *svg_path = NULL;           // output name, for pages after the first
+static svg_buf svg_body = {0};                // body of the open page
+static float svg_width = 0.0f;                // page size in points
+static float svg_height = 0.0f;
+static int svg_page_open = 0;
+static int svg_pages = 0;                     // pages started
+static int svg_error = 0;
+static float *svg_dot_radius = NULL;         // radius of each dot symbol
+static int svg_dot_count = 0;
+static int svg_dot_cap = 0;
+static svg_glyph *svg_glyphs = NULL;
+static int svg_glyph_count = 0;
+static int *svg_glyph_index = NULL;           // (font + 1) * 256 + code -> glyph + 1 (0 = undefined)
+static int svg_index_fonts = 0;               // fonts covered by svg_glyph_index
+static int *svg_page_glyphs = NULL;           // glyphs placed on the open page, in order of first use
+static int svg_page_glyph_count = 0;
+
+static void svg_buf_write(svg_buf *b, const char *s, size_t n) {
+    if (b->len + n + 1 > b->cap) {
+        while (b->len + n + 1 > b->cap) b->cap = b->cap ? b->cap * 2 : 65536;
+        b->data = (char*)realloc(b->data, b->cap);
+    }
+    memcpy(b->data + b->len, s, n);
+    b->len += n;
+}
+
+static void svg_buf_str(svg_buf *b, const char *s) {
+    svg_buf_write(b, s, strlen(s));
+}
+
+// Append v with up to two decimals, without trailing zeros
+static void svg_buf_num(svg_buf *b, float v) {
+    char tmp[32];
+    char *p = tmp + sizeof(tmp);
+    long n = (long)(v * 100.0f + (v < 0 ? -0.5f : 0.5f));
+    int neg = n < 0;
+    unsigned long u = (unsigned long)(neg ? -n : n);
+    unsigned frac = (unsigned)(u % 100);
+    u /= 100;
+    if (frac) {
+        if (frac % 10) *--p = (char)('0' + frac % 10);
+        *--p = (char)('0' + frac / 10);
+        *--p = '.';
+    }
+    do {
+        *--p = (char)('0' + u % 10);
+        u /= 10;
+    } while (u);
+    if (neg) *--p = '-';
+    svg_buf_write(b, p, (size_t)(tmp + sizeof(tmp) - p));
+}
+
+// Append prefix, the two numbers separated by a space, and suffix
+static void svg_buf_xy(svg_buf *b, const char *prefix, float x, const char *mid, float y, const char *suffix) {
+    svg_buf_str(b, prefix);
+    svg_buf_num(b, x);
+    svg_buf_str(b, mid);
+    svg_buf_num(b, y);
+    svg_buf_str(b, suffix);
+}
+
+// Index of the dot symbol for radius r (points)
+static int svg_dot_symbol(float r) {
+    for (int i = 0; i < svg_dot_count; i++) {
+        if (svg_dot_radius[i] == r) return i;
+    }
+    if (svg_dot_count == svg_dot_cap) {
+        svg_dot_cap = svg_dot_cap ? svg_dot_cap * 2 : 4;
+        svg_dot_radius = (float*)realloc(svg_dot_radius, sizeof(float) * svg_dot_cap);
+    }
+    svg_dot_radius[svg_dot_count] = r;
+    return svg_dot_count++;
+}
+
+// Glyph slot of font/code in the index, growing it as needed
+static int *svg_glyph_slot(int font, int code) {
+    if (font + 1 >= svg_index_fonts) {
+        int n = font + 2;
+        svg_glyph_index = (int*)realloc(svg_glyph_index, sizeof(int) * 256 * n);
+        memset(svg_glyph_index + 256 * svg_index_fonts, 0, sizeof(int) * 256 * (n - svg_index_fonts));
+        svg_index_fonts = n;
+    }
+    return &svg_glyph_index[(font + 1) * 256 + (code & 0xFF)];
+}
+
+static svg_glyph *svg_add_glyph(int font, int code, svg_buf *def) {
+    svg_glyphs = (svg_glyph*)realloc(svg_glyphs, sizeof(svg_glyph) * (svg_glyph_count + 1));
+    svg_glyph *g = &svg_glyphs[svg_glyph_count];
+    g->font = font;
+    g->code = code & 0xFF;
+    g->def = def->data;
+    g->len = def->len;
+    g->page = 0;
+    *svg_glyph_slot(font, code) = ++svg_glyph_count;
+    return g;
+}
+
+static void svg_glyph_id(svg_buf *b, const svg_glyph *g) {
+    char id[32];
+    if (g->font == SVG_FONT_TTF) snprintf(id, sizeof(id), "c%d", g->code);
+    else snprintf(id, sizeof(id), "g%d_%d", g->font, g->code);
+    svg_buf_str(b, id);
+}
+
+// Write the open page to its file
+static void svg_write_page() {
+    FILE *f = svg_out;
+    char *name = NULL;
+    if (svg_pages > 1) {
+        if (!svg_path) {
+            fprintf(stderr, "Warning: page %d not written (SVG output to stdout holds one page)\n", svg_pages);
+            return;
+        }
+        name = raster_page_name(svg_path, svg_pages);
+        f = fopen(name, "wb");
+        if (!f) {
+            fprintf(stderr, "Error opening file %s\n", name);
+            svg_error = 1;
+            free(name);
+            return;
+        }
+    }
+    svg_buf head = {0};
+    svg_buf_xy(&head, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                      "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"",
+               svg_width, "pt\" height=\"", svg_height, "pt\"");
+    svg_buf_xy(&head, " viewBox=\"0 0 ", svg_width, " ", svg_height, "\">\n<defs>\n");
+    for (int i = 0; i < svg_dot_count; i++) {
+        char sym[64];
+        snprintf(sym, sizeof(sym), "<symbol id=\"d%d\" overflow=\"visible\"><circle r=\"", i);
+        svg_buf_str(&head, sym);
+        svg_buf_num(&head, svg_dot_radius[i]);
+        svg_buf_str(&head, "\"/></symbol>\n");
+    }
+    for (int i = 0; i < svg_page_glyph_count; i++) {
+        const svg_glyph *g = &svg_glyphs[svg_page_glyphs[i]];
+        svg_buf_str(&head, "<g id=\"");
+        svg_glyph_id(&head, g);
+        svg_buf_str(&head, "\">");
+        if (g->len) svg_buf_write(&head, g->def, g->len);
+        svg_buf_str(&head, "</g>\n");
+    }
+    svg_buf_str(&head, "</defs>\n");
+    fwrite(head.data, 1, head.len, f);
+    fwrite(svg_body.data, 1, svg_body.len, f);
+    fputs("</svg>\n", f);
+    free(head.data);
+    if (ferror(f)) svg_error = 1;
+    if (name) {
+        if (fclose(f)) svg_error = 1;
+        free(name);
+    }
+}
+
+// Start SVG output to out; path is its file name (NULL for stdout)
+void svg_init(FILE *out, const char *path) {
+    svg_out = out;
+    svg_path = path;
+    svg_page_open = 0;
+    svg_pages = 0;
+    svg_error = 0;
+    svg_dot_count = 0;
+    for (int i = 0; i < svg_glyph_count; i++) free(svg_glyphs[i].def);
+    svg_glyph_count = 0;
+    if (svg_glyph_index) memset(svg_glyph_index, 0, sizeof(int) * 256 * svg_index_fonts);
+}
+
+// Write the open page, if any
+void svg_flush_page() {
+    if (!svg_page_open) return;
+    svg_write_page();
+    svg_page_open = 0;
+}
+
+// Write the open page and start a blank one of w x h points
+void svg_new_page(float w_pt, float h_pt) {
+    svg_flush_page();
+    svg_width = w_pt;
+    svg_height = h_pt;
+    svg_body.len = 0;
+    svg_page_glyph_count = 0;
+    svg_pages++;
+    svg_page_open = 1;
+}
+
+// Write the last page. Returns nonzero if writing failed.
+int svg_finish() {
+    svg_flush_page();
+    fflush(svg_out);
+    return svg_error || ferror(svg_out) ? 1 : 0;
+}
+
+// Place a dot of radius r_pt centered at (cx, cy) points
+static void svg_dot(float cx, float cy, float r_pt) {
+    if (!svg_page_open) return;
+    char ref[32];
+    snprintf(ref, sizeof(ref), "<use href=\"#d%d\" x=\"", svg_dot_symbol(r_pt));
+    svg_buf_xy(&svg_body, ref, cx, "\" y=\"", svg_height - cy, "\"/>\n");
+}
+
+// Fill a circle of radius r points centered at (cx, cy)
+static void svg_fill_circle(float cx, float cy, float r_pt) {
+    if (!svg_page_open) return;
+    svg_buf_xy(&svg_body, "<circle cx=\"", cx, "\" cy=\"", svg_height - cy, "\" r=\"");
+    svg_buf_num(&svg_body, r_pt);
+    svg_buf_str(&svg_body, "\"/>\n");
+}
+
+// Fill the rectangle with corner (x, y) and size w x h points with color rgb
+static void svg_fill_rect(float x, float y, float w, float h, const float rgb[3]) {
+    if (!svg_page_open) return;
+    svg_buf_xy(&svg_body, "<rect x=\"", x, "\" y=\"", svg_height - y - h, "\" width=\"");
+    svg_buf_xy(&svg_body, "", w, "\" height=\"", h, "\"");
+    char fill[32];
+    snprintf(fill, sizeof(fill), " fill=\"#%02x%02x%02x\"/>\n",
+             (int)(rgb[0] * 255.0f + 0.5f), (int)(rgb[1] * 255.0f + 0.5f), (int)(rgb[2] * 255.0f + 0.5f));
+    svg_buf_str(&svg_body, fill);
+}
+
+// Define glyph code of Type3 variant font from n dots given in points
+// relative to the glyph origin (y grows upwards), each of radius radius_pt
+static void svg_define_dot_glyph(int font, int code, int n, const float *dx_pt, const float *dy_pt, float radius_pt) {
+    if (*svg_glyph_slot(font, code)) return;
+    char ref[32];
+    snprintf(ref, sizeof(ref), "<use href=\"#d%d\" x=\"", svg_dot_symbol(radius_pt));
+    svg_buf def = {0};
+    for (int i = 0; i < n; i++) svg_buf_xy(&def, ref, dx_pt[i], "\" y=\"", -dy_pt[i], "\"/>");
+    svg_add_glyph(font, code, &def);
+}
+
+// Place glyph code of font with its origin at (x, y) points, in gray
+// (0 = black). Nothing is drawn if the glyph is undefined.
+static void svg_use_glyph(int font, int code, float x, float y, unsigned char gray) {
+    if (!svg_page_open) return;
+    int *slot = svg_glyph_slot(font, code);
+    if (!*slot) return;
+    svg_glyph *g = &svg_glyphs[*slot - 1];
+    if (g->len == 0) return;                  // no ink (space)
+    if (g->page != svg_pages) {
+        g->page = svg_pages;
+        svg_page_glyphs = (int*)realloc(svg_page_glyphs, sizeof(int) * (svg_page_glyph_count + 1));
+        svg_page_glyphs[svg_page_glyph_count++] = *slot - 1;
+    }
+    svg_buf_str(&svg_body, "<use href=\"#");
+    svg_glyph_id(&svg_body, g);
+    svg_buf_xy(&svg_body, "\" x=\"", x, "\" y=\"", svg_height - y, "\"");
+    if (gray) {
+        char fill[24];
+        snprintf(fill, sizeof(fill), " fill=\"#%02x%02x%02x\"", gray, gray, gray);
+        svg_buf_str(&svg_body, fill);
+    }
+    svg_buf_str(&svg_body, "/>\n");
+}
+
+// Place character code of the TrueType font (len bytes) at size_pt with its
+// origin at (x, y) points, defining its glyph from the outline on first use
+static void svg_draw_char(const unsigned char *font, size_t len, int code, float x, float y, float size_pt, unsigned char gray) {
+    if (!*svg_glyph_slot(SVG_FONT_TTF, code)) {
+        ttf_outline o = {0};
+        int upem = ttf_char_outline(font, len, (unsigned)(code & 0xFF), &o);
+        svg_buf def = {0};
+        if (upem && o.count > 0) {
+            // font units to points, y down
+            float k = size_pt / upem;
+            svg_buf_str(&def, "<path d=\"");
+            for (int i = 0; i < o.count; i++) {
+                const ttf_segment *s = &o.seg[i];
+                if (i == 0 || s->x0 != o.seg[i - 1].x1 || s->y0 != o.seg[i - 1].y1) {
+                    svg_buf_xy(&def, i == 0 ? "M" : "ZM", s->x0 * k, " ", -s->y0 * k, "");
+                }
+                if (s->cx == s->x0 && s->cy == s->y0) {
+                    svg_buf_xy(&def, "L", s->x1 * k, " ", -s->y1 * k, "");
+                } else {
+                    svg_buf_xy(&def, "Q", s->cx * k, " ", -s->cy * k, " ");
+                    svg_buf_xy(&def, "", s->x1 * k, " ", -s->y1 * k, "");
+                }
+            }
+            svg_buf_str(&def, "Z\"/>");
+        }
+        free(o.seg);
+        svg_add_glyph(SVG_FONT_TTF, code, &def);
+    }
+    svg_use_glyph(SVG_FONT_TTF, code, x, y, gray);
+}
+
+#endif // SVG_H
@@ -0,0 +1,488 @@
+#ifndef TTF_H
+#define TTF_H
+
+#include <stdlib.h>
+#include <string.h>
+
+// --- TrueType subsetting ---
+// Builds a copy of a TrueType font that keeps only the outlines of the
+// glyphs needed for a set of 8-bit character codes (plus .notdef and the
+// components of composite glyphs). Glyph ids are preserved: unused glyphs
+// become empty 'loca' entries, so 'cmap' and 'hmtx' stay valid unchanged.
+// Only the tables a PDF viewer needs for an embedded FontFile2 are kept.
+
+// Tables copied into the subset, in tag order as the directory requires
+static const char *const ttf_keep_tables[] = {
+    "OS/2", "cmap", "cvt ", "fpgm", "glyf", "head", "hhea", "hmtx", "loca", "maxp", "post", "prep"
+};
+#define TTF_KEEP_COUNT (int)(sizeof(ttf_keep_tables) / sizeof(ttf_keep_tables[0]))
+
+typedef struct {
+    const unsigned char *data;
+    unsigned long len;
+} ttf_table;
+
+static unsigned ttf_u16(const unsigned char *p) {
+    return ((unsigned)p[0] << 8) | p[1];
+}
+
+static unsigned long ttf_u32(const unsigned char *p) {
+    return ((unsigned long)p[0] << 24) | ((unsigned long)p[1] << 16) | ((unsigned long)p[2] << 8) | p[3];
+}
+
+static void ttf_put16(unsigned char *p, unsigned v) {
+    p[0] = (unsigned char)(v >> 8);
+    p[1] = (unsigned char)v;
+}
+
+static void ttf_put32(unsigned char *p, unsigned long v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+// Locate table tag in the font. Returns 0 if it is missing or out of range.
+static int ttf_find(const unsigned char *font, size_t len, const char *tag, ttf_table *t) {
+    if (len < 12) return 0;
+    unsigned n = ttf_u16(font + 4);
+    if (12 + (size_t)n * 16 > len) return 0;
+    for (unsigned i = 0; i < n; i++) {
+        const unsigned char *e = font + 12 + i * 16;
+        if (memcmp(e, tag, 4) != 0) continue;
+        unsigned long off = ttf_u32(e + 8);
+        unsigned long l = ttf_u32(e + 12);
+        if (off > len || l > len - off) return 0;
+        t->data = font + off;
+        t->len = l;
+        return 1;
+    }
+    return 0;
+}
+
+// Glyph id of character code c through the cmap table: the Windows Unicode
+// (3,1) format 4 subtable if present, else Windows symbol (3,0) with codes
+// at U+F0xx, else Macintosh (1,0) format 0. Returns 0 (.notdef) if unmapped.
+static unsigned ttf_glyph_for(const ttf_table *cmap, unsigned c) {
+    const unsigned char *p = cmap->data;
+    if (cmap->len < 4) return 0;
+    unsigned n = ttf_u16(p + 2);
+    const unsigned char *sub4 = NULL, *sym4 = NULL, *mac0 = NULL;
+    for (unsigned i = 0; i < n && 4 + (i + 1) * 8 <= cmap->len; i++) {
+        const unsigned char *e = p + 4 + i * 8;
+        unsigned long off = ttf_u32(e + 4);
+        if (off + 6 > cmap->len) continue;
+        const unsigned char *st = p + off;
+        unsigned platform = ttf_u16(e), encoding = ttf_u16(e + 2), format = ttf_u16(st);
+        if (platform == 3 && encoding == 1 && format == 4) sub4 = st;
+        if (platform == 3 && encoding == 0 && format == 4) sym4 = st;
+        if (platform == 1 && encoding == 0 && format == 0) mac0 = st;
+    }
+    if (!sub4 && sym4) {
+        sub4 = sym4;
+        c |= 0xF000;
+    }
+    if (sub4) {
+        // bounds: segments must lie inside the cmap table
+        size_t avail = (size_t)(cmap->data + cmap->len - sub4);
+        unsigned segs = ttf_u16(sub4 + 6) / 2;
+        if (16 + (size_t)segs * 8 > avail) return 0;
+        const unsigned char *end = sub4 + 14;
+        const unsigned char *start = end + segs * 2 + 2;
+        const unsigned char *delta = start + segs * 2;
+        const unsigned char *range = delta + segs * 2;
+        for (unsigned i = 0; i < segs; i++) {
+            if (ttf_u16(end + i * 2) < c) continue;
+            unsigned first = ttf_u16(start + i * 2);
+            if (first > c) return 0;
+            unsigned d = ttf_u16(delta + i * 2);
+            unsigned ro = ttf_u16(range + i * 2);
+            if (ro == 0) return (c + d) & 0xFFFF;
+            const unsigned char *g = range + i * 2 + ro + (c - first) * 2;
+            if (g + 2 > sub4 + avail) return 0;
+            unsigned gid = ttf_u16(g);
+            return gid ? (gid + d) & 0xFFFF : 0;
+        }
+        return 0;
+    }
+    if (mac0 && c < 256 && (size_t)(mac0 - p) + 6 + 256 <= cmap->len) return mac0[6 + c];
+    return 0;
+}
+
+static unsigned long ttf_checksum(const unsigned char *p, size_t len) {
+    unsigned long sum = 0;
+    size_t i = 0;
+    for (; i + 4 <= len; i += 4) sum += ttf_u32(p + i);
+    if (i < len) {
+        unsigned char last[4] = {0};
+        memcpy(last, p + i, len - i);
+        sum += ttf_u32(last);
+    }
+    return sum & 0xFFFFFFFFUL;
+}
+
+// Subset font (len bytes) to the glyphs of the character codes c with
+// used[c] set. Returns a malloc'd font and its length in out_len, or NULL
+// if the font cannot be parsed (the caller then embeds the whole font).
+unsigned char *ttf_subset(const unsigned char *font, size_t len, const unsigned char used[256], size_t *out_len) {
+    ttf_table head, maxp, loca, glyf, cmap;
+    if (!ttf_find(font, len, "head", &head) || head.len < 54 ||
+        !ttf_find(font, len, "maxp", &maxp) || maxp.len < 6 ||
+        !ttf_find(font, len, "loca", &loca) || !ttf_find(font, len, "glyf", &glyf) ||
+        !ttf_find(font, len, "cmap", &cmap)) {
+        return NULL;
+    }
+    unsigned nglyphs = ttf_u16(maxp.data + 4);
+    int long_loca = ttf_u16(head.data + 50) != 0;
+    if (loca.len < (unsigned long)(nglyphs + 1) * (long_loca ? 4 : 2)) return NULL;
+
+    // Glyph offsets into 'glyf'
+    unsigned long *off = (unsigned long*)malloc(sizeof(unsigned long) * (nglyphs + 1));
+    for (unsigned g = 0; g <= nglyphs; g++) {
+        off[g] = long_loca ? ttf_u32(loca.data + g * 4) : ttf_u16(loca.data + g * 2) * 2UL;
+        if (off[g] > glyf.len || (g > 0 && off[g] < off[g - 1])) {
+            free(off);
+            return NULL;
+        }
+    }
+
+    // Glyphs to keep: .notdef, the mapped characters, and composite components
+    unsigned char *keep = (unsigned char*)calloc(nglyphs, 1);
+    unsigned *todo = (unsigned*)malloc(sizeof(unsigned) * (nglyphs + 257));
+    int ntodo = 0;
+    todo[ntodo++] = 0;
+    for (unsigned c = 0; c < 256; c++) {
+        if (used[c]) todo[ntodo++] = ttf_glyph_for(&cmap, c);
+    }
+    while (ntodo > 0) {
+        unsigned g = todo[--ntodo];
+        if (g >= nglyphs || keep[g]) continue;
+        keep[g] = 1;
+        const unsigned char *p = glyf.data + off[g];
+        unsigned long glen = off[g + 1] - off[g];
+        if (glen < 10 || (short)ttf_u16(p) >= 0) continue;
+        // composite glyph: queue its components
+        unsigned long q = 10;
+        unsigned flags;
+        do {
+            if (q + 4 > glen) break;
+            flags = ttf_u16(p + q);
+            todo[ntodo++] = ttf_u16(p + q + 2);
+            q += 4 + ((flags & 0x0001) ? 4 : 2);                         // ARG_1_AND_2_ARE_WORDS
+            if (flags & 0x0008) q += 2;                                  // WE_HAVE_A_SCALE
+            else if (flags & 0x0040) q += 4;                             // WE_HAVE_AN_X_AND_Y_SCALE
+            else if (flags & 0x0080) q += 8;                             // WE_HAVE_A_TWO_BY_TWO
+        } while ((flags & 0x0020) && ntodo < (int)nglyphs + 257);        // MORE_COMPONENTS
+    }
+    free(todo);
+
+    // New 'glyf' and 'loca' (same loca format; offsets stay 4-byte aligned)
+    unsigned long glyf_len = 0;
+    for (unsigned g = 0; g < nglyphs; g++) {
+        if (keep[g]) glyf_len += (off[g + 1] - off[g] + 3) & ~3UL;
+    }
+    if (!long_loca && glyf_len / 2 > 0xFFFF) long_loca = 1;
+    unsigned char *new_glyf = (unsigned char*)calloc(glyf_len + 1, 1);
+    unsigned long loca_len = (unsigned long)(nglyphs + 1) * (long_loca ? 4 : 2);
+    unsigned char *new_loca = (unsigned char*)malloc(loca_len);
+    unsigned long pos = 0;
+    for (unsigned g = 0; g <= nglyphs; g++) {
+        if (long_loca) ttf_put32(new_loca + g * 4, pos);
+        else ttf_put16(new_loca + g * 2, (unsigned)(pos / 2));
+        if (g < nglyphs && keep[g]) {
+            memcpy(new_glyf + pos, glyf.data + off[g], off[g + 1] - off[g]);
+            pos += (off[g + 1] - off[g] + 3) & ~3UL;
+        }
+    }
+    free(keep);
+    free(off);
+
+    // Collect the tables to write
+    ttf_table tables[TTF_KEEP_COUNT];
+    const char *tags[TTF_KEEP_COUNT];
+    int ntables = 0;
+    for (int i = 0; i < TTF_KEEP_COUNT; i++) {
+        ttf_table t;
+        const char *tag = ttf_keep_tables[i];
+        if (strcmp(tag, "glyf") == 0) {
+            t.data = new_glyf;
+            t.len = glyf_len;
+        } else if (strcmp(tag, "loca") == 0) {
+            t.data = new_loca;
+            t.len = loca_len;
+        } else if (!ttf_find(font, len, tag, &t)) {
+            continue;
+        }
+        // post: keep the header only (format 3, no glyph names)
+        if (strcmp(tag, "post") == 0 && t.len > 32) t.len = 32;
+        tags[ntables] = tag;
+        tables[ntables++] = t;
+    }
+
+    size_t total = 12 + (size_t)ntables * 16;
+    for (int i = 0; i < ntables; i++) total += (tables[i].len + 3) & ~3UL;
+    unsigned char *out = (unsigned char*)calloc(total, 1);
+    memcpy(out, font, 4);                     // sfnt version
+    unsigned es = 0;
+    while ((2u << es) <= (unsigned)ntables) es++;
+    ttf_put16(out + 4, (unsigned)ntables);
+    ttf_put16(out + 6, (1u << es) * 16);
+    ttf_put16(out + 8, es);
+    ttf_put16(out + 10, (unsigned)ntables * 16 - (1u << es) * 16);
+    size_t at = 12 + (size_t)ntables * 16;
+    size_t head_at = 0;
+    for (int i = 0; i < ntables; i++) {
+        unsigned char *e = out + 12 + i * 16;
+        unsigned char *d = out + at;
+        memcpy(d, tables[i].data, tables[i].len);
+        if (strcmp(tags[i], "head") == 0) {
+            head_at = at;
+            ttf_put32(d + 8, 0);              // checkSumAdjustment, set below
+            ttf_put16(d + 50, long_loca ? 1 : 0);
+        } else if (strcmp(tags[i], "post") == 0 && tables[i].len >= 4) {
+            ttf_put32(d, 0x00030000UL);
+        }
+        memcpy(e, tags[i], 4);
+        ttf_put32(e + 4, ttf_checksum(d, tables[i].len));
+        ttf_put32(e + 8, (unsigned long)at);
+        ttf_put32(e + 12, tables[i].len);
+        at += (tables[i].len + 3) & ~3UL;
+    }
+    ttf_put32(out + head_at + 8, (0xB1B0AFBAUL - ttf_checksum(out, total)) & 0xFFFFFFFFUL);
+    free(new_glyf);
+    free(new_loca);
+    *out_len = total;
+    return out;
+}
+
+// --- Glyph outlines ---
+// Outlines of single glyphs for rendering without a PDF viewer (raster
+// output): quadratic segments in font units (y up), with the implied
+// on-curve points between consecutive off-curve points made explicit and
+// composite glyphs expanded. Hinting instructions are ignored.
+
+#define TTF_MAX_COMPOSITE_DEPTH 8
+
+typedef struct {
+    float x0, y0;                             // start
+    float cx, cy;                             // control point (equal to the start for a line)
+    float x1, y1;                             // end
+} ttf_segment;
+
+typedef struct {
+    ttf_segment *seg;
+    int count;
+    int cap;
+} ttf_outline;
+
+static void ttf_outline_add(ttf_outline *o, const float *m, float x0, float y0, float cx, float cy, float x1, float y1) {
+    if (o->count == o->cap) {
+        o->cap = o->cap ? o->cap * 2 : 64;
+        o->seg = (ttf_segment*)realloc(o->seg, sizeof(ttf_segment) * o->cap);
+    }
+    // m is the affine transform of the (composite) glyph: x' = m0 x + m2 y + m4, y' = m1 x + m3 y + m5
+    ttf_segment *s = &o->seg[o->count++];
+    s->x0 = m[0] * x0 + m[2] * y0 + m[4];
+    s->y0 = m[1] * x0 + m[3] * y0 + m[5];
+    s->cx = m[0] * cx + m[2] * cy + m[4];
+    s->cy = m[1] * cx + m[3] * cy + m[5];
+    s->x1 = m[0] * x1 + m[2] * y1 + m[4];
+    s->y1 = m[1] * x1 + m[3] * y1 + m[5];
+}
+
+// Append the outline of glyph g (transformed by m) to o
+static void ttf_add_glyph(const ttf_table *loca, const ttf_table *glyf, int long_loca, unsigned nglyphs,
+                          unsigned g, const float *m, ttf_outline *o, int depth) {
+    if (g >= nglyphs || depth > TTF_MAX_COMPOSITE_DEPTH) return;
+    if (loca->len < (unsigned long)(g + 2) * (long_loca ? 4 : 2)) return;
+    unsigned long start = long_loca ? ttf_u32(loca->data + g * 4) : ttf_u16(loca->data + g * 2) * 2UL;
+    unsigned long end = long_loca ? ttf_u32(loca->data + g * 4 + 4) : ttf_u16(loca->data + g * 2 + 2) * 2UL;
+    if (end > glyf->len || start + 10 > end) return;
+    const unsigned char *p = glyf->data + start;
+    unsigned long glen = end - start;
+    int contours = (short)ttf_u16(p);
+
+    if (contours < 0) {
+        // composite glyph: transformed components
+        unsigned long q = 10;
+        unsigned flags;
+        do {
+            if (q + 4 > glen) return;
+            flags = ttf_u16(p + q);
+            unsigned comp = ttf_u16(p + q + 2);
+            q += 4;
+            float dx = 0.0f, dy = 0.0f;
+            if (flags & 0x0001) {                                         // ARG_1_AND_2_ARE_WORDS
+                if (q + 4 > glen) return;
+                dx = (float)(short)ttf_u16(p + q);
+                dy = (float)(short)ttf_u16(p + q + 2);
+                q += 4;
+            } else {
+                if (q + 2 > glen) return;
+                dx = (float)(signed char)p[q];
+                dy = (float)(signed char)p[q + 1];
+                q += 2;
+            }
+            if (!(flags & 0x0002)) dx = dy = 0.0f;                        // point matching is not supported
+            float a = 1.0f, b = 0.0f, c = 0.0f, d = 1.0f;
+            if (flags & 0x0008) {                                         // WE_HAVE_A_SCALE
+                if (q + 2 > glen) return;
+                a = d = (short)ttf_u16(p + q) / 16384.0f;
+                q += 2;
+            } else if (flags & 0x0040) {                                  // WE_HAVE_AN_X_AND_Y_SCALE
+                if (q + 4 > glen) return;
+                a = (short)ttf_u16(p + q) / 16384.0f;
+                d = (short)ttf_u16(p + q + 2) / 16384.0f;
+                q += 4;
+            } else if (flags & 0x0080) {                                  // WE_HAVE_A_TWO_BY_TWO
+                if (q + 8 > glen) return;
+                a = (short)ttf_u16(p + q) / 16384.0f;
+                b = (short)ttf_u16(p + q + 2) / 16384.0f;
+                c = (short)ttf_u16(p + q + 4) / 16384.0f;
+                d = (short)ttf_u16(p + q + 6) / 16384.0f;
+                q += 8;
+            }
+            const float cm[6] = {
+                m[0] * a + m[2] * b, m[1] * a + m[3] * b,
+                m[0] * c + m[2] * d, m[1] * c + m[3] * d,
+                m[0] * dx + m[2] * dy + m[4], m[1] * dx + m[3] * dy + m[5]
+            };
+            ttf_add_glyph(loca, glyf, long_loca, nglyphs, comp, cm, o, depth + 1);
+        } while (flags & 0x0020);                                         // MORE_COMPONENTS
+        return;
+    }
+
+    // simple glyph: contour end points, instructions, flags, x and y deltas
+    if (contours == 0 || 10 + (unsigned long)contours * 2 + 2 > glen) return;
+    const unsigned char *ends = p + 10;
+    unsigned npts = ttf_u16(ends + (contours - 1) * 2) + 1;
+    unsigned long q = 10 + (unsigned long)contours * 2;
+    q += 2 + ttf_u16(p + q);
+    unsigned char *fl = (unsigned char*)malloc(npts);
+    float *x = (float*)malloc(sizeof(float) * npts);
+    float *y = (float*)malloc(sizeof(float) * npts);
+    int ok = 1;
+    for (unsigned i = 0; i < npts && ok;) {
+        if (q >= glen) {
+            ok = 0;
+            break;
+        }
+        unsigned char f = p[q++];
+        unsigned rep = 1;
+        if (f & 0x08) {
+            if (q >= glen) {
+                ok = 0;
+                break;
+            }
+            rep += p[q++];
+        }
+        while (rep-- > 0 && i < npts) fl[i++] = f;
+    }
+    int v = 0;
+    for (unsigned i = 0; i < npts && ok; i++) {
+        if (fl[i] & 0x02) {                                               // x-Short
+            if (q + 1 > glen) {
+                ok = 0;
+                break;
+            }
+            v += (fl[i] & 0x10) ? p[q] : -(int)p[q];
+            q += 1;
+        } else if (!(fl[i] & 0x10)) {                                     // not "same as previous"
+            if (q + 2 > glen) {
+                ok = 0;
+                break;
+            }
+            v += (short)ttf_u16(p + q);
+            q += 2;
+        }
+        x[i] = (float)v;
+    }
+    v = 0;
+    for (unsigned i = 0; i < npts && ok; i++) {
+        if (fl[i] & 0x04) {                                               // y-Short
+            if (q + 1 > glen) {
+                ok = 0;
+                break;
+            }
+            v += (fl[i] & 0x20) ? p[q] : -(int)p[q];
+            q += 1;
+        } else if (!(fl[i] & 0x20)) {
+            if (q + 2 > glen) {
+                ok = 0;
+                break;
+            }
+            v += (short)ttf_u16(p + q);
+            q += 2;
+        }
+        y[i] = (float)v;
+    }
+
+    // each contour starts at an on-curve point (or the midpoint of the first
+    // two off-curve points) and walks once around back to it
+    unsigned s = 0;
+    for (int k = 0; k < contours && ok; k++) {
+        unsigned e = ttf_u16(ends + k * 2);
+        if (e < s || e >= npts) break;
+        unsigned n = e - s + 1;
+        unsigned first = 0;
+        while (first < n && !(fl[s + first] & 0x01)) first++;
+        float sx, sy;
+        if (first < n) {
+            sx = x[s + first];
+            sy = y[s + first];
+        } else {
+            first = 0;
+            sx = (x[s] + x[s + (n > 1)]) * 0.5f;
+            sy = (y[s] + y[s + (n > 1)]) * 0.5f;
+        }
+        float px = sx, py = sy, qx = 0.0f, qy = 0.0f;
+        int have_ctrl = 0;
+        for (unsigned j = 1; j <= n; j++) {
+            unsigned i = s + (first + j) % n;
+            if (fl[i] & 0x01) {
+                if (have_ctrl) ttf_outline_add(o, m, px, py, qx, qy, x[i], y[i]);
+                else ttf_outline_add(o, m, px, py, px, py, x[i], y[i]);
+                px = x[i];
+                py = y[i];
+                have_ctrl = 0;
+            } else if (have_ctrl) {
+                float mx = (qx + x[i]) * 0.5f, my = (qy + y[i]) * 0.5f;
+                ttf_outline_add(o, m, px, py, qx, qy, mx, my);
+                px = mx;
+                py = my;
+                qx = x[i];
+                qy = y[i];
+            } else {
+                qx = x[i];
+                qy = y[i];
+                have_ctrl = 1;
+            }
+        }
+        if (have_ctrl) ttf_outline_add(o, m, px, py, qx, qy, sx, sy);
+        else if (px != sx || py != sy) ttf_outline_add(o, m, px, py, px, py, sx, sy);
+        s = e + 1;
+    }
+    free(fl);
+    free(x);
+    free(y);
+}
+
+// Outline of the glyph for character code c, appended to o (free o->seg
+// when done). Returns the font's units per em, or 0 if the font cannot be
+// parsed.
+int ttf_char_outline(const unsigned char *font, size_t len, unsigned c, ttf_outline *o) {
+    ttf_table head, maxp, loca, glyf, cmap;
+    if (!ttf_find(font, len, "head", &head) || head.len < 54 ||
+        !ttf_find(font, len, "maxp", &maxp) || maxp.len < 6 ||
+        !ttf_find(font, len, "loca", &loca) || !ttf_find(font, len, "glyf", &glyf) ||
+        !ttf_find(font, len, "cmap", &cmap)) {
+        return 0;
+    }
+    static const float identity[6] = { 1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f };
+    ttf_add_glyph(&loca, &glyf, ttf_u16(head.data + 50) != 0, ttf_u16(maxp.data + 4),
+                  ttf_glyph_for(&cmap, c), identity, o, 0);
+    unsigned upem = ttf_u16(head.data + 18);
+    return upem ? (int)upem : 1000;
+}
+
+#endif // TTF_H